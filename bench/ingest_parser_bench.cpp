@@ -0,0 +1,147 @@
+#include "include/order.hpp"
+#include "include/p_insert.hpp"
+#include "include/price.hpp"
+#include "src/ingest_parser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Ingestion parsing throughput of IngestParser against the getline and stringstream parsing it
+// replaced, in lines and megabytes per second over the same file.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -I. src/*.cpp bench/ingest_parser_bench.cpp -o ingest_parser_bench -pthread
+// Run on a generated file of the given number of lines (5000000 by default), or on an existing
+// ingestion file:
+//   ./ingest_parser_bench 10000000
+//   ./ingest_parser_bench orders.txt
+
+static const double TICK_SIZE = 0.01;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// The line parsing ingestion used before IngestParser: a stream and a string for every field
+static Order convert_line_order(std::string file_line)
+{
+    std::stringstream stream(file_line);
+    std::istream_iterator<std::string> begin(stream);
+    std::istream_iterator<std::string> end;
+    std::vector<std::string> fields(begin, end);
+
+    Side side = fields[3] == BUY_STR ? BUY : SELL;
+
+    Category cat;
+    if (fields[4] == CANCEL_STR)
+        cat = CANCEL;
+    else if (fields[4] == TRADE_STR)
+        cat = TRADE;
+    else
+        cat = NEW;
+
+    Order order(fields[2],
+                std::stoull(fields[0]),
+                std::stoull(fields[1]),
+                side,
+                cat,
+                std::stoull(fields[6]),
+                to_ticks(atof(fields[5].c_str()), TICK_SIZE));
+
+    return order;
+}
+
+// An ingestion file of count lines with increasing epochs and prices of two decimals
+static void write_source(const std::string &source_file, size_t count)
+{
+    std::ofstream source(source_file);
+    std::mt19937_64 rng(1);
+    uint64_t epoch = 1600000000000000000ULL;
+    for (size_t line = 0; line < count; line++)
+    {
+        epoch += rng() % 100000;
+        const char *category = rng() % 3 ? "NEW" : rng() % 2 ? "CANCEL" : "TRADE";
+        source << epoch << " " << line << " AAPL " << (rng() % 2 ? "BUY" : "SELL") << " " << category << " "
+               << 150 + (rng() % 1000) * 0.01 << " " << 1 + rng() % 500 << "\n";
+    }
+}
+
+static void report(const char *name, size_t lines, double megabytes, double seconds)
+{
+    printf("%-24s %12zu %14.0f %10.1f\n", name, lines, lines / seconds, megabytes / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    std::string source_file;
+    bool is_generated = argc < 2 || std::strtoull(argv[1], nullptr, 10) > 0;
+    if (is_generated)
+    {
+        size_t count = argc < 2 ? 5000000 : std::strtoull(argv[1], nullptr, 10);
+        source_file = std::filesystem::temp_directory_path().string() + "/ingest_parser_bench.txt";
+        write_source(source_file, count);
+    }
+    else
+        source_file = argv[1];
+
+    double megabytes = std::filesystem::file_size(source_file) / 1e6;
+
+    // both sides sum what they parsed, so neither can be optimised away and they are compared
+    uint64_t stream_sum = 0;
+    size_t stream_lines = 0;
+    bench_clock::time_point start = bench_clock::now();
+    {
+        std::ifstream source(source_file);
+        std::string line;
+        while (std::getline(source, line))
+        {
+            Order order = convert_line_order(line);
+            stream_sum += order.epoch + order.qty + order.price;
+            stream_lines++;
+        }
+    }
+    double stream_seconds = seconds_since(start);
+
+    uint64_t parser_sum = 0;
+    size_t parser_lines = 0;
+    start = bench_clock::now();
+    {
+        IngestParser parser(source_file);
+        IngestLine line;
+        while (parser.next(line))
+        {
+            DataOrder order = line.ticked(TICK_SIZE);
+            parser_sum += order.epoch + order.qty + order.price;
+            parser_lines++;
+        }
+    }
+    double parser_seconds = seconds_since(start);
+
+    if (is_generated)
+        std::filesystem::remove(source_file);
+
+    printf("%-24s %12s %14s %10s\n", "parser", "lines", "lines/s", "MB/s");
+    report("getline + stringstream", stream_lines, megabytes, stream_seconds);
+    report("IngestParser", parser_lines, megabytes, parser_seconds);
+    printf("speedup %.1fx\n", stream_seconds / parser_seconds);
+
+    if (stream_sum != parser_sum || stream_lines != parser_lines)
+    {
+        printf("the parsers disagree on the file\n");
+        return 1;
+    }
+
+    return 0;
+}
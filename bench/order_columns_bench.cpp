@@ -0,0 +1,154 @@
+#include "include/order.hpp"
+#include "src/order_columns.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <stdint.h>
+
+// Epoch search and traded volume over the orders of a chunk, stored as records (AoS) and as the
+// columns chunks now use (SoA). Each column kernel runs both as the scalar fallback and as the
+// dispatched one, which is AVX2 wherever the CPU has it and the same scalar loop otherwise.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -I. src/*.cpp bench/order_columns_bench.cpp -o order_columns_bench -pthread
+// Run with the number of orders in the chunk (65536 by default):
+//   ./order_columns_bench 1000000
+
+static const int SEARCHES = 2000000;
+static const int SCANS = 2000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double nanos_since(bench_clock::time_point start, double repeats)
+{
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / repeats;
+}
+
+static bool is_vectorised()
+{
+#ifdef OW_HAS_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// Orders with increasing epochs, a third of them trades
+static std::vector<DataOrder> make_orders(size_t count)
+{
+    std::mt19937_64 rng(1);
+    std::vector<DataOrder> orders(count);
+    uint64_t epoch = 1000;
+    for (size_t i = 0; i < count; i++)
+    {
+        epoch += rng() % 50;
+        orders[i].epoch = epoch;
+        orders[i].id = i;
+        orders[i].side = rng() % 2 ? BUY : SELL;
+        orders[i].category = (Category)(rng() % 3);
+        orders[i].qty = 1 + rng() % 100;
+        orders[i].price = 1000 + rng() % 50;
+    }
+
+    return orders;
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc < 2 ? 65536 : std::strtoull(argv[1], nullptr, 10);
+    if (count == 0)
+        return 1;
+
+    std::vector<DataOrder> orders = make_orders(count);
+    // uint64_t storage keeps the columns 8 byte aligned, as they are in a chunk mapping
+    std::vector<uint64_t> storage(count * ORDER_COLUMN_BYTES / sizeof(uint64_t) + 1);
+    store_columns((char *)storage.data(), orders.data(), count);
+    OrderColumns columns = map_columns((const char *)storage.data(), count);
+
+    std::mt19937_64 rng(2);
+    uint64_t first_epoch = orders.front().epoch;
+    uint64_t last_epoch = orders.back().epoch;
+    std::vector<uint64_t> keys(SEARCHES);
+    for (uint64_t &key : keys)
+        key = first_epoch + rng() % (last_epoch - first_epoch + 1);
+
+    volatile size_t sink = 0;
+    const char *vector_name = is_vectorised() ? "SoA AVX2" : "SoA dispatched (scalar)";
+
+    printf("%zu orders, %s\n\n", count, is_vectorised() ? "AVX2 available" : "no AVX2, dispatch falls back to scalar");
+    printf("%-26s %14s\n", "epoch search", "ns/search");
+
+    // the linear walk is what reading the records one by one costs, so it only runs a fraction
+    int walks = std::max(10, (int)(SEARCHES / (count / 64 + 1)));
+    bench_clock::time_point start = bench_clock::now();
+    for (int walk = 0; walk < walks; walk++)
+    {
+        size_t i = 0;
+        while (i < count && orders[i].epoch < keys[walk])
+            i++;
+        sink = sink + i;
+    }
+    printf("%-26s %14.1f\n", "AoS linear walk", nanos_since(start, walks));
+
+    start = bench_clock::now();
+    for (uint64_t key : keys)
+        sink = sink + epoch_lower_bound(orders.data(), count, key);
+    printf("%-26s %14.1f\n", "AoS binary", nanos_since(start, SEARCHES));
+
+    start = bench_clock::now();
+    for (uint64_t key : keys)
+        sink = sink + (std::lower_bound(columns.epochs, columns.epochs + count, key) - columns.epochs);
+    printf("%-26s %14.1f\n", "SoA std::lower_bound", nanos_since(start, SEARCHES));
+
+    start = bench_clock::now();
+    for (uint64_t key : keys)
+        sink = sink + epoch_lower_bound_scalar(columns.epochs, count, key);
+    printf("%-26s %14.1f\n", "SoA scalar", nanos_since(start, SEARCHES));
+
+    start = bench_clock::now();
+    for (uint64_t key : keys)
+        sink = sink + epoch_lower_bound(columns.epochs, count, key);
+    printf("%-26s %14.1f\n", vector_name, nanos_since(start, SEARCHES));
+
+    for (uint64_t key : keys)
+    {
+        size_t found = epoch_lower_bound(columns.epochs, count, key);
+        if (found != epoch_lower_bound(orders.data(), count, key) || found != epoch_lower_bound_scalar(columns.epochs, count, key))
+        {
+            printf("the searches disagree at %lu\n", key);
+            return 1;
+        }
+    }
+
+    printf("\n%-26s %14s\n", "traded volume", "ns/order");
+
+    uint64_t record_qty = 0;
+    start = bench_clock::now();
+    for (int scan = 0; scan < SCANS; scan++)
+        record_qty += traded_qty(orders.data(), count);
+    printf("%-26s %14.3f\n", "AoS", nanos_since(start, (double)SCANS * count));
+
+    uint64_t scalar_qty = 0;
+    start = bench_clock::now();
+    for (int scan = 0; scan < SCANS; scan++)
+        scalar_qty += traded_qty_scalar(columns.qtys, columns.kinds, count);
+    printf("%-26s %14.3f\n", "SoA scalar", nanos_since(start, (double)SCANS * count));
+
+    uint64_t column_qty = 0;
+    start = bench_clock::now();
+    for (int scan = 0; scan < SCANS; scan++)
+        column_qty += traded_qty(columns, 0, count);
+    printf("%-26s %14.3f\n", vector_name, nanos_since(start, (double)SCANS * count));
+
+    if (record_qty != scalar_qty || scalar_qty != column_qty)
+    {
+        printf("the volume scans disagree\n");
+        return 1;
+    }
+
+    return 0;
+}
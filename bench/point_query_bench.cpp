@@ -0,0 +1,137 @@
+#include "include/config.hpp"
+#include "include/p_insert.hpp"
+#include "include/p_query.hpp"
+#include "src/indexer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Point query latency against the number of chunks of a symbol, at the first, middle and last
+// window. The chunk is found through EpochIndexer::floor, next to the sorted epoch list scan it
+// replaced, which grows with the chunk count.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -I. src/*.cpp bench/point_query_bench.cpp -o point_query_bench -pthread
+// Run with the chunk counts to compare (100 1000 10000 by default):
+//   ./point_query_bench 100 1000 10000 50000
+
+static const uint64_t WINDOW = 1000;
+static const int LOOKUPS = 20000;
+static const int QUERIES = 2000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double nanos_since(bench_clock::time_point start, int repeats)
+{
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / repeats;
+}
+
+// The lookup every point query made before the index had floor: the whole epoch list, scanned
+// for the last window at or before the epoch
+static uint64_t scan_epoch_list(EpochIndexer *idx, uint64_t epoch)
+{
+    std::vector<uint64_t> epochs = idx->epoch_list();
+    uint64_t found = AVL_EMPTY_NODE;
+    for (uint64_t window : epochs)
+    {
+        if (window > epoch)
+            break;
+        found = window;
+    }
+
+    return found;
+}
+
+// A symbol with one order in each of count windows, written by a single file ingestion
+static void fill_symbol(const std::string &data_dir, size_t count)
+{
+    std::string source_file = data_dir + "orders.txt";
+    {
+        std::ofstream source(source_file);
+        for (size_t window = 0; window < count; window++)
+            source << window * WINDOW + 1 << " " << window + 1 << " BENCH " << (window % 2 ? "BUY" : "SELL") << " NEW "
+                   << 100 + window % 10 << " " << 1 + window % 50 << "\n";
+    }
+
+    Config conf(data_dir, WINDOW);
+    PInsert inserter(&conf);
+    inserter.ingest_file(source_file, "BENCH");
+    conf.get_or_create_index("BENCH")->flush();
+}
+
+// Lookup and query latency at the first, middle and last window of the symbol
+static bool run_offsets(const std::string &data_dir, size_t count)
+{
+    // every query decodes its chunk, so only the lookup differs between chunk counts
+    Config conf(data_dir, WINDOW);
+    conf.decoded.set_budget(0);
+    PQuery querier(&conf);
+    EpochIndexer *idx = conf.get_or_create_index("BENCH");
+
+    const char *names[] = {"first", "middle", "last"};
+    size_t windows[] = {0, count / 2, count - 1};
+    for (int offset = 0; offset < 3; offset++)
+    {
+        uint64_t epoch = windows[offset] * WINDOW + WINDOW / 2;
+        volatile uint64_t sink = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (int lookup = 0; lookup < LOOKUPS; lookup++)
+            sink = sink + idx->floor(epoch + lookup % 2);
+        double floor_ns = nanos_since(start, LOOKUPS);
+
+        // the scan allocates the whole list, so it is repeated less the more chunks there are
+        int scans = std::max(10, (int)(LOOKUPS / (count / 100 + 1)));
+        start = bench_clock::now();
+        for (int scan = 0; scan < scans; scan++)
+            sink = sink + scan_epoch_list(idx, epoch + scan % 2);
+        double scan_ns = nanos_since(start, scans);
+
+        start = bench_clock::now();
+        for (int query = 0; query < QUERIES; query++)
+            sink = sink + querier.query_timestamp(epoch, "BENCH").last_trade_epoch;
+        double query_us = nanos_since(start, QUERIES) / 1000;
+
+        if (idx->floor(epoch) != scan_epoch_list(idx, epoch))
+        {
+            printf("floor and the list scan disagree at %lu\n", epoch);
+            return false;
+        }
+
+        printf("%8zu %8s %14.1f %14.1f %14.2f\n", count, names[offset], floor_ns, scan_ns, query_us);
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> counts;
+    for (int arg = 1; arg < argc; arg++)
+        counts.push_back(std::strtoull(argv[arg], nullptr, 10));
+    if (counts.empty())
+        counts = {100, 1000, 10000};
+
+    printf("%8s %8s %14s %14s %14s\n", "chunks", "window", "floor (ns)", "list scan (ns)", "query (us)");
+    for (size_t count : counts)
+    {
+        std::string data_dir = std::filesystem::temp_directory_path().string() + "/point_query_bench_" + std::to_string(count) + "/";
+        std::filesystem::remove_all(data_dir);
+        std::filesystem::create_directories(data_dir);
+        fill_symbol(data_dir, count);
+
+        if (!run_offsets(data_dir, count))
+            return 1;
+
+        std::filesystem::remove_all(data_dir);
+    }
+
+    return 0;
+}
@@ -2,6 +2,13 @@
 #define Config_HPP
 
 #include "../src/indexer.hpp"
+#include "../src/chunk_cache.hpp"
+#include "../src/chunk_writer.hpp"
+#include "../src/delta_log.hpp"
+#include "../src/segment.hpp"
+#include "../src/write_buffer.hpp"
+#include "price.hpp"
+#include <algorithm>
 #include <mutex>
 #include <string>
 #include <filesystem>
@@ -11,13 +18,75 @@
 // Default chunk window of 10 minutes
 static const uint64_t TEN_MINUTES = 600000000000;
 
+// Default number of orders replayed between two book checkpoints inside a chunk
+static const unsigned long CHECKPOINT_ORDERS = 4096;
+
 struct Config
 {
+    // both are only accessed under the registry mutex, as symbols can be added from several threads
+    std::mutex registry_mutex;
     std::unordered_map<std::string, std::mutex> locks;
     std::unordered_map<std::string, EpochIndexer *> indexes;
+    ChunkCache chunks{MAPPED_CHUNKS};
+    DecodedCache decoded{DECODED_BYTES}; // memory budget set through decoded.set_budget(bytes)
     std::string data_dir;
     const uint64_t epoch_window; // has to be constant for all usage
 
+    // A checkpoint is taken after this many orders, or once this many nanoseconds passed
+    // since the last one within a chunk (0 turns either trigger off)
+    unsigned long checkpoint_orders = CHECKPOINT_ORDERS;
+    uint64_t checkpoint_nanos = 0;
+
+    // Tick size of symbols without one in symbol_tick_sizes. Either only applies to symbols
+    // with no stored data yet, as the tick size is recorded in the index of each symbol
+    double default_tick_size = DEFAULT_TICK_SIZE;
+    std::unordered_map<std::string, double> symbol_tick_sizes;
+
+    // Every this many windows, the first chunk stores its whole base state (a keyframe), and the
+    // later chunks of those windows only the levels that differ from it. Larger values shrink base
+    // files, while loading a chunk reads at most one keyframe more either way (1 stores every base
+    // state whole). Like the tick size, it is recorded in the index once a symbol has data
+    unsigned int default_keyframe_windows = 1;
+    std::unordered_map<std::string, unsigned int> symbol_keyframe_windows;
+
+    // Layout newly written orders files store their orders in: raw records, a compact encoded log,
+    // or columns that scans over a single field read on their own. Chunks keep the layout they were
+    // written in until they are rewritten whole, and columns are always rewritten whole
+    OrderLayout order_layout = ORDER_RECORDS;
+
+    // Worker threads for multi-symbol file ingestion (0 uses one per core)
+    unsigned int ingest_threads = 0;
+
+    // Worker threads rewriting the chunks after a historical change to their base states
+    // (0 uses one per core)
+    unsigned int reconfig_threads = 0;
+
+    // Chunk writes file ingestion keeps in flight at once
+    size_t write_depth = WRITE_DEPTH;
+
+    // Once set, single-order inserts, updates and deletes go to per-symbol memtables backed by a
+    // write-ahead log, which are merged into the chunks in the background whenever one holds this
+    // many changes, and all of them on every flush interval (0 writes straight to the chunks)
+    size_t memtable_orders = 0;
+    unsigned int flush_interval_ms = FLUSH_INTERVAL_MS;
+
+    // Once set, chunks that are no longer appended to are packed into one segment file per this
+    // many windows of a symbol, so that a single mapping serves all of them. Symbols are packed
+    // after file ingestion and whenever they start a new window (or through segments.pack_all).
+    // Packed chunks are unpacked into files of their own whenever they are written, until the
+    // next pack (0 keeps every chunk in its own files, while segments stay readable)
+    unsigned int segment_windows = 0;
+    Segments segments{this};
+
+    // Once set, historical inserts, updates and deletes log their effect on the base states of
+    // later chunks, which are rewritten in the background once a symbol has this many changes
+    // logged (0 rewrites every later chunk right away, DELTA_COMPACT_RECORDS suits most loads)
+    size_t delta_compact_records = 0;
+    DeltaLogs deltas{this};
+
+    // declared last, so it is flushed before anything it uses is destroyed
+    WriteBuffer buffer{this};
+
     Config(std::string data_dir, uint64_t epoch_window) : data_dir(data_dir), epoch_window(epoch_window)
     {
         if (!std::filesystem::exists(data_dir))
@@ -30,14 +99,36 @@ struct Config
             std::filesystem::create_directory(data_dir);
     }
 
+    // Per-symbol lock for writers. Its address is stable, so it can be held without the registry
+    std::mutex &lock_for(const std::string &symbol)
+    {
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        return locks[symbol];
+    }
+
     EpochIndexer *get_or_create_index(std::string symbol)
     {
+        std::lock_guard<std::mutex> guard(registry_mutex);
         if (indexes.find(symbol) == indexes.end())
         {
-            indexes[symbol] = new EpochIndexer(symbol, data_dir, epoch_window);
+            auto tick = symbol_tick_sizes.find(symbol);
+            double tick_size = tick == symbol_tick_sizes.end() ? default_tick_size : tick->second;
+            auto keyframes = symbol_keyframe_windows.find(symbol);
+            unsigned int keyframe_windows = keyframes == symbol_keyframe_windows.end() ? default_keyframe_windows : keyframes->second;
+            indexes[symbol] = new EpochIndexer(symbol, data_dir, epoch_window, tick_size, keyframe_windows);
         }
         return indexes[symbol];
     }
+
+    double tick_size(std::string symbol)
+    {
+        return get_or_create_index(symbol)->tick_size;
+    }
+
+    unsigned int keyframe_windows(std::string symbol)
+    {
+        return std::max(1u, get_or_create_index(symbol)->keyframe_windows);
+    }
 };
 
 struct ConfigData
@@ -2,6 +2,7 @@
 #define Order_HPP
 
 #include <string>
+#include "price.hpp"
 
 enum Side
 {
@@ -24,7 +25,7 @@ struct Order
     Side side;
     Category category;
     uint32_t qty;
-    double price;
+    Price price;
 
     Order() {}
 
@@ -34,7 +35,7 @@ struct Order
           Side side,
           Category category,
           uint32_t qty,
-          double price)
+          Price price)
         : symbol(symbol),
           epoch(epoch),
           id(id),
@@ -51,7 +52,7 @@ struct DataOrder
     Side side;
     Category category;
     uint64_t qty;
-    double price;
+    Price price;
 
     DataOrder(Order &order)
     {
@@ -2,29 +2,69 @@
 #define OrderBook_HPP
 
 #include <functional>
-#include <unordered_map>
 #include <vector>
+#include <stddef.h>
 #include <stdint.h>
 #include "order.hpp"
+#include "price.hpp"
 
 struct OrderEntry
 {
     uint64_t qty;
-    double price;
+    Price price;
 
     OrderEntry() {}
-    OrderEntry(uint64_t qty, double price) : qty(qty), price(price) {}
+    OrderEntry(uint64_t qty, Price price) : qty(qty), price(price) {}
+};
+
+// Price levels for one side of the book, in a flat vector sorted from the worst price to the
+// best one. Keeping the touch at the back makes the best price O(1), top-N iteration O(depth),
+// and changes near the touch only shift the few levels behind them.
+class PriceLevels
+{
+    std::vector<OrderEntry> levels;
+    bool is_buy;
+
+    // whether price a is further from the touch than price b
+    inline bool worse(Price a, Price b) const { return is_buy ? a < b : a > b; }
+    std::vector<OrderEntry>::iterator position(Price price);
+
+public:
+    PriceLevels(bool is_buy) : is_buy(is_buy) {}
+
+    inline size_t size() const { return levels.size(); }
+    inline bool empty() const { return levels.empty(); }
+    inline void clear() { levels.clear(); }
+
+    // levels from the worst price to the best one, as they are stored on disk
+    inline const std::vector<OrderEntry> &entries() const { return levels; }
+    inline const OrderEntry &best() const { return levels.back(); }
+
+    const OrderEntry *find(Price price) const;
+    void add(uint64_t qty, Price price);
+    void remove(uint64_t qty, Price price);
+    // sets the quantity of a level, removing it for 0
+    void set(uint64_t qty, Price price);
+    void assign(const OrderEntry *begin, const OrderEntry *end);
+    std::vector<OrderEntry> top(size_t depth) const;
 };
 
 struct OrderBook
 {
-    std::unordered_map<double, OrderEntry> buy_map;
-    std::unordered_map<double, OrderEntry> sell_map;
+    PriceLevels buy_levels{true};
+    PriceLevels sell_levels{false};
 
     bool empty();
     void add(Order &order);
     std::vector<OrderEntry> buy_list();
     std::vector<OrderEntry> sell_list();
+
+    // nullptr when that side of the book is empty
+    const OrderEntry *best_bid() const;
+    const OrderEntry *best_ask() const;
+
+    // copy of the book holding only the best depth levels of each side (all of them for 0)
+    OrderBook top(size_t depth) const;
 };
 
-#endif
\ No newline at end of file
+#endif
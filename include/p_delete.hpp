@@ -5,6 +5,8 @@
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <stdint.h>
 
 class PDelete
@@ -15,6 +17,9 @@ public:
     PDelete(Config *conf);
 
     bool delete_order(std::string symbol, uint64_t id, uint64_t epoch);
+    // deletes orders of the symbol given as (id, epoch) pairs, rewriting every affected chunk
+    // only once; gives back how many were found
+    size_t delete_orders(std::string symbol, std::vector<std::pair<uint64_t, uint64_t>> orders);
 };
 
 #endif
\ No newline at end of file
@@ -4,21 +4,63 @@
 #include "order.hpp"
 #include "config.hpp"
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
 
 static const std::string BUY_STR = "BUY";
 static const std::string CANCEL_STR = "CANCEL";
 static const std::string NEW_STR = "NEW";
 static const std::string TRADE_STR = "TRADE";
 
+// Counters of one ingestion stage
+struct StageStats
+{
+    uint64_t items = 0;  // lines parsed, orders applied or chunks written
+    double seconds = 0;  // wall time of the stage
+    double waiting = 0;  // part of it spent blocked on a full or empty queue
+
+    // items per second of actual work
+    inline double throughput() const { return seconds > waiting ? items / (seconds - waiting) : 0; }
+};
+
+// Occupancy of a queue between two stages, sampled on every push
+struct QueueStats
+{
+    size_t capacity = 0;
+    size_t peak = 0;
+    double mean = 0;
+};
+
+// Counters of the last ingest_file call: the stage with the least waiting is the bottleneck,
+// and a queue that is mostly full points at the stage after it
+struct IngestStats
+{
+    uint64_t bytes = 0;
+    StageStats parse;
+    StageStats apply;
+    StageStats write;
+    QueueStats parsed_queue; // order batches from parse to apply
+    QueueStats chunk_queue;  // completed chunks from apply to write
+};
+
 struct PInsert
 {
     Config *conf;
+    IngestStats stats;
     
     PInsert();
     PInsert(Config *conf);
 
+    // ingests a file of one symbol in three stages running on their own threads, false if the
+    // file couldn't be read or any of its chunks couldn't be written
     bool ingest_file(std::string source_file, std::string symbol);
+    // ingests a file of interleaved symbols, with each symbol written by one of several workers
+    bool ingest_market_file(std::string source_file);
     std::pair<std::string, bool> insert(Order &order);
+    // inserts orders of any symbols and epochs, rewriting every affected chunk only once;
+    // gives back how many were stored
+    size_t insert_batch(std::vector<Order> &orders);
 };
 
 #endif
\ No newline at end of file
@@ -1,22 +1,83 @@
 #ifndef PQuery_HPP
 #define PQuery_HPP
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 #include <stdint.h>
 
+#include "order.hpp"
 #include "query_result.hpp"
 #include "config.hpp"
 
+// Cursor over a time range of one symbol, keeping a single live order book that is replayed
+// forward across chunk boundaries. Only the chunk at the start of the range is read from its
+// base state (or closest checkpoint), later chunks only contribute their orders.
+// With a step of 0 every order within the range is a stop, otherwise every step nanoseconds
+// from the start (the first stop being the start itself).
+class RangeCursor
+{
+    Config *conf;
+    std::string symbol;
+    uint64_t end;
+    uint64_t step;
+    uint64_t curr_epoch;
+    bool is_started = false;
+    bool is_done = false;
+
+    QueryResult state;
+    DataOrder event;
+    uint64_t file_epoch = 0;
+    std::shared_ptr<const DecodedChunk> chunk; // nullptr if the current chunk couldn't be read
+    bool is_open = false;
+    unsigned long applied = 0;
+
+    // buffered changes as of the cursor's creation, merged with the stored orders
+    std::shared_ptr<const MemSnapshot> pending;
+    size_t next_insert = 0;
+    uint64_t flushes = 0; // flushes of the memtable before the copy
+    uint64_t flushed_from = UINT64_MAX; // window from which on the chunks read hold the copy
+
+    void open_stored(uint64_t start);
+    const DataOrder *peek_stored(uint64_t until);
+    bool next_order(uint64_t until);
+
+public:
+    RangeCursor(Config *conf, std::string symbol, uint64_t start, uint64_t end, uint64_t step);
+
+    // moves to the next stop, false once the range is exhausted
+    bool next();
+
+    // replays every order up to the epoch, without moving the stop
+    void advance(uint64_t epoch);
+
+    inline uint64_t epoch() const { return curr_epoch; }
+    inline const QueryResult &snapshot() const { return state; }
+    inline const DataOrder &last_order() const { return event; }
+};
+
 struct PQuery
 {
     Config *conf;
 
     PQuery(Config *conf);
 
-    QueryResult query_timestamp(uint64_t epoch, std::string symbol);
-    std::vector<QueryResult> query_multiple(const std::vector<uint64_t> &epochs, std::string symbol);
+    // a depth limits the result to the best levels of each side, 0 returning the full book.
+    // Buffered changes of the write buffer are merged in, with the symbol's lock held
+    QueryResult query_timestamp(uint64_t epoch, std::string symbol, size_t depth = 0);
+    // only what is stored in the chunks, without buffered changes
+    QueryResult query_stored(uint64_t epoch, std::string symbol, size_t depth = 0);
+    std::vector<QueryResult> query_multiple(const std::vector<uint64_t> &epochs, std::string symbol, size_t depth = 0);
+    // total qty of the trades from the start to the end epoch (both included), with buffered
+    // changes merged in. Stored orders are scanned without replaying any book
+    uint64_t traded_volume(uint64_t start, uint64_t end, std::string symbol);
+    RangeCursor query_range(uint64_t start, uint64_t end, uint64_t step, std::string symbol);
+    void query_range(uint64_t start,
+                     uint64_t end,
+                     std::string symbol,
+                     std::function<void(const DataOrder &, const QueryResult &)> on_event);
 };
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "config.hpp"
 #include "order.hpp"
+#include <vector>
 
 class PUpdate
 {
@@ -12,6 +13,9 @@ public:
     PUpdate(Config *conf);
 
     bool update_order(Order &order);
+    // updates orders of any symbols, rewriting every affected chunk only once;
+    // gives back how many were found
+    size_t update_orders(std::vector<Order> &orders);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef Price_HPP
+#define Price_HPP
+
+#include <cmath>
+#include <stdint.h>
+
+// Prices are kept as a whole number of ticks of the symbol's tick size, so that
+// the same price always compares (and sorts) equal within a book
+typedef int64_t Price;
+
+// Default tick size of a symbol, unless set in the config before its first write
+static const double DEFAULT_TICK_SIZE = 0.01;
+
+inline Price to_ticks(double price, double tick_size)
+{
+    return std::llround(price / tick_size);
+}
+
+inline double to_price(Price ticks, double tick_size)
+{
+    return ticks * tick_size;
+}
+
+#endif
@@ -25,6 +25,7 @@ static const std::string HELP = "/help";
 static const std::string EXIT = "/exit";
 static const std::string SELECT = "SELECT";
 static const std::string MULTIPLE = "MULTIPLE";
+static const std::string DEPTH = "DEPTH";
 static const std::string INSERT = "INSERT";
 static const std::string DELETE = "DELETE";
 static const std::string UPDATE = "UPDATE";
@@ -41,8 +42,10 @@ static const std::string HELP_MSG = (std::string) "Help Menu\n" +
                                     "List of commands:\n" +
                                     "[get order book at epoch]\n" +
                                     "\tSELECT <symbol> AT <epoch>\n\n" +
-                                    "[order books at multiple epochs]\n" +
-                                    "\tSELECT MULTIPLE <symbol> AT <epoch1> <epoch2> .. <epoch n>\n\n" +
+                                    "[best n levels of each side of the order book at epoch]\n" +
+                                    "\tSELECT <symbol> AT <epoch> DEPTH <n>\n\n" +
+                                    "[order books at multiple epochs, optionally limited to the best n levels]\n" +
+                                    "\tSELECT MULTIPLE <symbol> AT <epoch1> <epoch2> .. <epoch n> [DEPTH <n>]\n\n" +
                                     "[insert one order into database - use engine directly for file ingestions]\n" +
                                     "\tINSERT <symbol> AT <epoch> VALUES <id> <side:BUY/SELL> <category:NEW/TRADE/CANCEL> <price> <quantity>\n\n" +
                                     "[delete order by epoch-id pair for a symbol]\n" +
@@ -50,7 +53,7 @@ static const std::string HELP_MSG = (std::string) "Help Menu\n" +
                                     "[update order by epoch-id pair for a symbol]\n" +
                                     "\tUPDATE <symbol> WITH <epoch> <id> VALUES <side:BUY/SELL> <category:NEW/TRADE/CANCEL> <price> <quantity>\n\n";
 
-void process_update(std::vector<std::string> fields, PUpdate &updater)
+void process_update(std::vector<std::string> fields, PUpdate &updater, double tick_size)
 {
     Side side = fields[6] == BUY_STR ? BUY : SELL;
 
@@ -68,7 +71,7 @@ void process_update(std::vector<std::string> fields, PUpdate &updater)
                 side,
                 cat,
                 std::stoull(fields[9]),
-                atof(fields[8].c_str()));
+                to_ticks(atof(fields[8].c_str()), tick_size));
 
     if (updater.update_order(order))
 
@@ -91,7 +94,7 @@ void process_delete(std::vector<std::string> fields, PDelete &deleter)
         std::cout << "Deletion failed!\n";
 }
 
-void process_insert(std::vector<std::string> fields, PInsert &inserter)
+void process_insert(std::vector<std::string> fields, PInsert &inserter, double tick_size)
 {
     Side side = fields[6] == BUY_STR ? BUY : SELL;
 
@@ -109,7 +112,7 @@ void process_insert(std::vector<std::string> fields, PInsert &inserter)
                 side,
                 cat,
                 std::stoull(fields[9]),
-                atof(fields[8].c_str()));
+                to_ticks(atof(fields[8].c_str()), tick_size));
 
     if (inserter.insert(order).second)
         std::cout << "Insertion successful!\n";
@@ -130,7 +133,7 @@ std::string get_two_precision(double val)
     return stream.str();
 }
 
-void prettify_query_res(QueryResult &res, uint64_t epoch)
+void prettify_query_res(QueryResult &res, uint64_t epoch, double tick_size)
 {
     std::vector<OrderEntry> buys = res.book.buy_list();
     std::vector<OrderEntry> sells = res.book.sell_list();
@@ -141,7 +144,7 @@ void prettify_query_res(QueryResult &res, uint64_t epoch)
     pretty_print("Last traded quantity:", 25, ' ');
     pretty_print(res.last_trade_qty, 25, '\n');
     pretty_print("Last traded price:", 25, ' ');
-    pretty_print(get_two_precision(res.last_trade_price), 25, '\n');
+    pretty_print(get_two_precision(to_price(res.last_trade_price, tick_size)), 25, '\n');
 
     std::cout << "\nBuy orders in order book:\n";
     std::cout << "-------------------------\n";
@@ -150,7 +153,7 @@ void prettify_query_res(QueryResult &res, uint64_t epoch)
     for (OrderEntry &entry : buys)
     {
         pretty_print(entry.qty, 15, ' ');
-        pretty_print(entry.price, 20, '\n');
+        pretty_print(to_price(entry.price, tick_size), 20, '\n');
     }
 
     std::cout << "\nSell orders in order book:\n";
@@ -160,20 +163,31 @@ void prettify_query_res(QueryResult &res, uint64_t epoch)
     for (OrderEntry &entry : sells)
     {
         pretty_print(entry.qty, 15, ' ');
-        pretty_print(entry.price, 20, '\n');
+        pretty_print(to_price(entry.price, tick_size), 20, '\n');
     }
 }
 
 void process_select_many(std::vector<std::string> fields, PQuery &querier)
 {
     std::string symbol = fields[2];
-    for (unsigned int i = 4; i < fields.size(); i++)
+    size_t depth = 0;
+    size_t epochs_end = fields.size();
+    if (fields.size() >= 7 && fields[fields.size() - 2] == DEPTH)
+    {
+        depth = std::stoull(fields[fields.size() - 1]);
+        epochs_end -= 2;
+    }
+
+    std::vector<uint64_t> epochs;
+    for (unsigned int i = 4; i < epochs_end; i++)
     {
         std::string epoch_str = fields[i];
-        uint64_t epoch = std::stoull(epoch_str);
-        QueryResult res = querier.query_timestamp(epoch, symbol);
-        prettify_query_res(res, epoch);
+        epochs.push_back(std::stoull(epoch_str));
     }
+
+    std::vector<QueryResult> results = querier.query_multiple(epochs, symbol, depth);
+    for (unsigned int i = 0; i < results.size(); i++)
+        prettify_query_res(results[i], epochs[i], querier.conf->tick_size(symbol));
 }
 
 void process_select_one(std::vector<std::string> fields, PQuery &querier)
@@ -181,8 +195,13 @@ void process_select_one(std::vector<std::string> fields, PQuery &querier)
     std::string symbol = fields[1];
     std::string epoch_str = fields[3];
     uint64_t epoch = std::stoull(epoch_str);
-    QueryResult res = querier.query_timestamp(epoch, symbol);
-    prettify_query_res(res, epoch);
+
+    size_t depth = 0;
+    if (fields.size() >= 6 && fields[4] == DEPTH)
+        depth = std::stoull(fields[5]);
+
+    QueryResult res = querier.query_timestamp(epoch, symbol, depth);
+    prettify_query_res(res, epoch, querier.conf->tick_size(symbol));
 }
 
 bool process_input(std::string input, PInsert &inserter, PDelete &deleter, PUpdate &updater, PQuery &querier)
@@ -208,7 +227,7 @@ bool process_input(std::string input, PInsert &inserter, PDelete &deleter, PUpda
     }
     else if (fields.size() >= 10 && fields[0] == INSERT)
     {
-        process_insert(fields, inserter);
+        process_insert(fields, inserter, inserter.conf->tick_size(fields[1]));
     }
     else if (fields.size() >= 5 && fields[0] == DELETE)
     {
@@ -216,7 +235,7 @@ bool process_input(std::string input, PInsert &inserter, PDelete &deleter, PUpda
     }
     else if (fields.size() >= 10 && fields[0] == UPDATE)
     {
-        process_update(fields, updater);
+        process_update(fields, updater, querier.conf->tick_size(fields[1]));
     }
     else if (fields[0] == HELP)
     {
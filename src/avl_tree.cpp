@@ -198,22 +198,73 @@ int AVLTree<T>::find(T &value)
         return idx + (direct->left ? direct->left->count : 0);
 }
 
+// Greatest value that is lower than or equal to the given one
 template <typename T>
-uint64_t AVLTree<T>::first_lower(AVLNode<T> *node, T &value)
+uint64_t AVLTree<T>::floor(T &value)
 {
-    if (!node)
-        return AVL_EMPTY_NODE;
+    AVLNode<T> *direct = root;
+    uint64_t result = AVL_EMPTY_NODE;
+
+    while (direct)
+    {
+        if (direct->value == value)
+            return direct->value;
 
-    if (!node->left && !node->right && node->value > value)
-        return AVL_EMPTY_NODE;
+        if (direct->value < value)
+        {
+            result = direct->value;
+            direct = direct->right;
+        }
+        else
+            direct = direct->left;
+    }
 
-    if ((node->value <= value && !node->right) || (node->value <= value && node->right->value > value))
-        return node->value;
+    return result;
+}
 
-    if (node->value >= value)
-        return first_lower(node->left, value);
-    else
-        return first_lower(node->right, value);
+// Smallest value that is higher than or equal to the given one
+template <typename T>
+uint64_t AVLTree<T>::ceiling(T &value)
+{
+    AVLNode<T> *direct = root;
+    uint64_t result = AVL_EMPTY_NODE;
+
+    while (direct)
+    {
+        if (direct->value == value)
+            return direct->value;
+
+        if (direct->value > value)
+        {
+            result = direct->value;
+            direct = direct->left;
+        }
+        else
+            direct = direct->right;
+    }
+
+    return result;
+}
+
+// Smallest value that is strictly higher than the given one
+template <typename T>
+uint64_t AVLTree<T>::successor(T &value)
+{
+    AVLNode<T> *direct = root;
+    uint64_t result = AVL_EMPTY_NODE;
+
+    while (direct)
+    {
+        if (direct->value > value)
+        {
+            result = direct->value;
+            direct = direct->left;
+        }
+        else
+            direct = direct->right;
+    }
+
+    return result;
 }
 
 template <typename T>
@@ -242,24 +293,6 @@ T &AVLTree<T>::operator[](std::size_t idx)
     return cur->value;
 }
 
-template <typename T>
-uint64_t AVLTree<T>::first_higher(AVLNode<T> *node, T &value)
-{
-    if (!node)
-        return AVL_EMPTY_NODE;
-
-    if (!node->left && !node->right && node->value < value)
-        return AVL_EMPTY_NODE;
-
-    if ((node->value >= value && !node->left) || (node->value >= value && node->left->value < value))
-        return node->value;
-
-    if (node->value <= value)
-        return first_higher(node->right, value);
-    else
-        return first_higher(node->left, value);
-}
-
 template <typename T>
 AVLNode<T> *AVLNode<T>::left_rotate()
 {
@@ -406,7 +439,8 @@ void inorder_recursive_from(AVLNode<T> *root, std::vector<T> &result, T &value)
     if (!root)
         return;
 
-    if (root->left)
+    // nothing on the left can be higher than the value if the root isn't
+    if (root->left && root->value > value)
         inorder_recursive_from(root->left, result, value);
 
     if (root->value > value)
@@ -422,14 +456,14 @@ void inorder_recursive_from_incl(AVLNode<T> *root, std::vector<T> &result, T &va
     if (!root)
         return;
 
-    if (root->left)
-        inorder_recursive_from(root->left, result, value);
+    if (root->left && root->value > value)
+        inorder_recursive_from_incl(root->left, result, value);
 
     if (root->value >= value)
         result.push_back(root->value);
 
     if (root->right)
-        inorder_recursive_from(root->right, result, value);
+        inorder_recursive_from_incl(root->right, result, value);
 }
 
 template <typename T>
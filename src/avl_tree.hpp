@@ -1,6 +1,7 @@
 #ifndef AVLTree_HPP
 #define AVLTree_HPP
 
+#include <cstddef>
 #include <vector>
 #include <stdint.h>
 #include <limits>
@@ -49,8 +50,9 @@ struct AVLTree
     void insert(T &value);
     bool exists(T &value);
     int find(T &value);
-    uint64_t first_higher(AVLNode<T> *node, T &value);
-    uint64_t first_lower(AVLNode<T> *node, T &value);
+    uint64_t floor(T &value);
+    uint64_t ceiling(T &value);
+    uint64_t successor(T &value);
     void deserialize(std::vector<T> &data);
     std::vector<T> serialize();
     std::vector<T> serialize_inorder();
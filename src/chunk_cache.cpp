@@ -0,0 +1,160 @@
+#include "chunk_cache.hpp"
+
+DecodedChunk::DecodedChunk(const ChunkReader &reader)
+{
+    header = reader.header();
+    reader.base_book(base);
+
+    Span<Checkpoint> table = reader.checkpoints();
+    checkpoints.assign(table.begin(), table.end());
+    for (size_t idx = 0; idx < table.size(); idx++)
+    {
+        Span<OrderEntry> buys = reader.checkpoint_buy(idx);
+        Span<OrderEntry> sells = reader.checkpoint_sell(idx);
+        checkpoint_offsets.push_back(checkpoint_levels.size());
+        checkpoint_levels.insert(checkpoint_levels.end(), buys.begin(), buys.end());
+        checkpoint_levels.insert(checkpoint_levels.end(), sells.begin(), sells.end());
+    }
+
+    reader.read_orders(orders);
+}
+
+void DecodedChunk::checkpoint_book(size_t idx, OrderBook &book) const
+{
+    const Checkpoint &checkpoint = checkpoints[idx];
+    const OrderEntry *levels = checkpoint_levels.data() + checkpoint_offsets[idx];
+    fill_book(book,
+              Span<OrderEntry>(levels, checkpoint.book_buy),
+              Span<OrderEntry>(levels + checkpoint.book_buy, checkpoint.book_sell));
+}
+
+size_t DecodedChunk::footprint() const
+{
+    return sizeof(DecodedChunk) +
+           (base.buy_levels.size() + base.sell_levels.size() + checkpoint_levels.size()) * sizeof(OrderEntry) +
+           checkpoints.size() * (sizeof(Checkpoint) + sizeof(size_t)) +
+           orders.size() * sizeof(DataOrder);
+}
+
+DecodedCache::DecodedCache(size_t budget) : budget(budget) {}
+
+std::shared_ptr<const DecodedChunk> DecodedCache::get(const std::string &symbol, uint64_t epoch)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    auto found = entries.find({symbol, epoch});
+    if (found == entries.end())
+    {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, found->second);
+    return found->second->second;
+}
+
+void DecodedCache::put(const std::string &symbol, uint64_t epoch, std::shared_ptr<const DecodedChunk> chunk)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    // a chunk larger than the whole budget would only flush everything else out
+    if (chunk->footprint() > budget)
+        return;
+
+    auto found = entries.find({symbol, epoch});
+    if (found != entries.end())
+    {
+        used -= found->second->second->footprint();
+        lru.erase(found->second);
+        entries.erase(found);
+    }
+
+    lru.emplace_front(chunk_key(symbol, epoch), chunk);
+    entries[{symbol, epoch}] = lru.begin();
+    used += chunk->footprint();
+    evict();
+}
+
+void DecodedCache::patch(const std::string &symbol, uint64_t epoch, std::shared_ptr<const DecodedChunk> chunk)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    auto found = entries.find({symbol, epoch});
+    if (found == entries.end())
+        return;
+
+    used -= found->second->second->footprint();
+    if (chunk->footprint() > budget)
+    {
+        lru.erase(found->second);
+        entries.erase(found);
+        return;
+    }
+
+    found->second->second = chunk;
+    used += chunk->footprint();
+    evict();
+}
+
+void DecodedCache::invalidate(const std::string &symbol, uint64_t epoch)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    auto found = entries.find({symbol, epoch});
+    if (found == entries.end())
+        return;
+
+    used -= found->second->second->footprint();
+    lru.erase(found->second);
+    entries.erase(found);
+}
+
+std::shared_ptr<const DecodedChunk> DecodedCache::peek(const std::string &symbol, uint64_t epoch)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    auto found = entries.find({symbol, epoch});
+    if (found == entries.end())
+        return nullptr;
+
+    return found->second->second;
+}
+
+void DecodedCache::set_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    budget = bytes;
+    evict();
+}
+
+void DecodedCache::clear()
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    entries.clear();
+    lru.clear();
+    used = 0;
+}
+
+DecodedStats DecodedCache::stats()
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    DecodedStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.bytes = used;
+    stats.chunks = entries.size();
+    return stats;
+}
+
+// Drops the least recently used chunks until the cache fits its budget (lock held by the caller)
+void DecodedCache::evict()
+{
+    while (used > budget && !lru.empty())
+    {
+        used -= lru.back().second->footprint();
+        entries.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
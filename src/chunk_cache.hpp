@@ -0,0 +1,88 @@
+#ifndef ChunkCache_HPP
+#define ChunkCache_HPP
+
+#include "include/order.hpp"
+#include "include/order_book.hpp"
+#include "header.hpp"
+#include "chunk_reader.hpp"
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Default memory budget for decoded chunks, in bytes
+static const size_t DECODED_BYTES = 256 * 1024 * 1024;
+
+// A chunk decoded into memory: its base book, checkpoint snapshots and orders
+struct DecodedChunk
+{
+    Header header;
+    OrderBook base;
+    std::vector<Checkpoint> checkpoints;
+    std::vector<OrderEntry> checkpoint_levels; // buy then sell levels of every checkpoint, back to back
+    std::vector<size_t> checkpoint_offsets;
+    std::vector<DataOrder> orders;
+
+    DecodedChunk() {}
+    DecodedChunk(const ChunkReader &reader);
+
+    void checkpoint_book(size_t idx, OrderBook &book) const;
+    size_t footprint() const;
+};
+
+struct DecodedStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t bytes = 0;
+    size_t chunks = 0;
+};
+
+// LRU cache of decoded chunks keyed by (symbol, window epoch), bounded by a memory budget
+// rather than a chunk count since chunk sizes vary wildly between symbols
+class DecodedCache
+{
+    typedef std::pair<std::string, uint64_t> chunk_key;
+    typedef std::pair<chunk_key, std::shared_ptr<const DecodedChunk>> cache_entry;
+
+    struct key_hash
+    {
+        size_t operator()(const chunk_key &key) const
+        {
+            return std::hash<std::string>()(key.first) ^ (std::hash<uint64_t>()(key.second) << 1);
+        }
+    };
+
+    std::mutex cache_mutex;
+    size_t budget;
+    size_t used = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    std::list<cache_entry> lru;
+    std::unordered_map<chunk_key, std::list<cache_entry>::iterator, key_hash> entries;
+
+    void evict();
+
+public:
+    DecodedCache(size_t budget);
+
+    // nullptr (counted as a miss) if the chunk isn't cached
+    std::shared_ptr<const DecodedChunk> get(const std::string &symbol, uint64_t epoch);
+    void put(const std::string &symbol, uint64_t epoch, std::shared_ptr<const DecodedChunk> chunk);
+    // replaces the entry only if the chunk is already cached, so bulk writes don't flood the cache
+    void patch(const std::string &symbol, uint64_t epoch, std::shared_ptr<const DecodedChunk> chunk);
+    void invalidate(const std::string &symbol, uint64_t epoch);
+    // like get, but doesn't count as a hit or miss, nor refresh the entry
+    std::shared_ptr<const DecodedChunk> peek(const std::string &symbol, uint64_t epoch);
+    void set_budget(size_t bytes);
+    void clear();
+    DecodedStats stats();
+};
+
+#endif
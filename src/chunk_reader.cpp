@@ -0,0 +1,519 @@
+#include "chunk_reader.hpp"
+#include "chunk_writer.hpp"
+#include "order_log.hpp"
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Record layouts of version 0 chunks, where prices were stored as doubles
+struct LegacyHeader
+{
+    unsigned long base_buy;
+    unsigned long base_sell;
+    unsigned long update_size;
+    unsigned long last_trade_qty;
+    double last_trade_price;
+    uint64_t last_trade_epoch;
+    unsigned long checkpoints;
+};
+
+struct LegacyCheckpoint
+{
+    unsigned long order_count;
+    uint64_t epoch;
+    unsigned long book_buy;
+    unsigned long book_sell;
+    unsigned long last_trade_qty;
+    double last_trade_price;
+    uint64_t last_trade_epoch;
+};
+
+struct LegacyEntry
+{
+    uint64_t qty;
+    double price;
+};
+
+struct LegacyOrder
+{
+    uint64_t epoch;
+    uint64_t id;
+    Side side;
+    Category category;
+    uint64_t qty;
+    double price;
+};
+
+// Maps a whole file read-only, nullptr if it is missing or empty
+static void *map_file(const std::string &filename, size_t &length)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size == 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    length = file_stat.st_size;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    return mapping == MAP_FAILED ? nullptr : mapping;
+}
+
+ChunkReader::ChunkReader(const std::string &filename, double legacy_tick_size)
+{
+    // the base file can be replaced by a newer one when the base state is rewritten twice between
+    // mapping the orders file and its base file, so both are mapped again
+    for (int attempt = 0; attempt < MAP_ATTEMPTS; attempt++)
+    {
+        is_stale = false;
+        open(filename, legacy_tick_size);
+        if (!is_stale)
+            return;
+
+        release();
+    }
+}
+
+// Packed chunks are read straight from the segment's mapping, as they are never written in place
+ChunkReader::ChunkReader(const PackedChunk &packed) : segment(packed.segment)
+{
+    const ChunkLocation &location = packed.location;
+    if (location.end() > segment->size() || location.orders_length < header_size(BASE_FILE_VERSION))
+        return;
+
+    const char *cursor = segment->data() + location.offset;
+    const Header *header = (const Header *)cursor;
+    is_valid = header->magic == CHUNK_MAGIC && header->version >= BASE_FILE_VERSION &&
+               map_orders(cursor, cursor + location.orders_length) &&
+               map_base_file(segment->data() + location.base_offset(), location.base_length);
+}
+
+void ChunkReader::open(const std::string &filename, double legacy_tick_size)
+{
+    mapping = map_file(filename, length);
+    if (!mapping)
+        return;
+
+    const char *cursor = (const char *)mapping;
+    const char *limit = cursor + length;
+
+    if (length >= sizeof(LegacyHeader) && *(const uint32_t *)cursor == CHUNK_MAGIC)
+    {
+        is_valid = ((const Header *)cursor)->version < BASE_FILE_VERSION ? map_chunk(cursor, limit)
+                                                                          : map_split_chunk(filename, cursor, limit);
+        return;
+    }
+
+    is_valid = length >= sizeof(LegacyHeader) && convert_legacy_chunk(cursor, limit, legacy_tick_size);
+
+    // everything was copied out, so the mapping isn't needed anymore
+    munmap(mapping, length);
+    mapping = nullptr;
+}
+
+void ChunkReader::release()
+{
+    if (mapping)
+        munmap(mapping, length);
+    if (base_mapping)
+        munmap(base_mapping, base_length);
+
+    mapping = nullptr;
+    base_mapping = nullptr;
+    is_valid = false;
+    checkpoint_levels.clear();
+}
+
+// Checkpoint table, base state and checkpoint levels, which follow each other in the same order
+// in both layouts
+bool ChunkReader::map_base(const char *&cursor, const char *limit)
+{
+    checkpoint_table = Span<Checkpoint>((const Checkpoint *)cursor, file_header.checkpoints);
+    cursor += checkpoint_table.size() * sizeof(Checkpoint);
+    if (cursor > limit)
+        return false;
+
+    buy_levels = Span<OrderEntry>((const OrderEntry *)cursor, file_header.base_buy);
+    cursor += buy_levels.size() * sizeof(OrderEntry);
+    sell_levels = Span<OrderEntry>((const OrderEntry *)cursor, file_header.base_sell);
+    cursor += sell_levels.size() * sizeof(OrderEntry);
+
+    for (const Checkpoint &checkpoint : checkpoint_table)
+    {
+        checkpoint_levels.push_back((const OrderEntry *)cursor);
+        cursor += (checkpoint.book_buy + checkpoint.book_sell) * sizeof(OrderEntry);
+        if (cursor > limit)
+            return false;
+    }
+
+    return cursor <= limit;
+}
+
+// Version 1 and 2 chunks, with every section in one file
+bool ChunkReader::map_chunk(const char *cursor, const char *limit)
+{
+    uint32_t version = ((const Header *)cursor)->version;
+    size_t size = header_size(version);
+    if (cursor + size > limit)
+        return false;
+
+    // copied out, as the header of the tail chunk is rewritten in place when orders are appended
+    memcpy((void *)&file_header, cursor, size);
+    if (version == 1)
+        file_header.delta_seq = 0;
+    file_header.base_stamp = 0;
+    file_header.base_ref = NO_BASE_REF;
+    file_header.order_bytes = 0;
+    file_header.order_layout = ORDER_RECORDS;
+    cursor += size;
+
+    if (!map_base(cursor, limit))
+        return false;
+
+    order_list = Span<DataOrder>((const DataOrder *)cursor, file_header.update_size);
+    cursor += order_list.size() * sizeof(DataOrder);
+    used_length = cursor - (const char *)mapping;
+
+    return cursor <= limit;
+}
+
+// Orders file of a chunk and the base file its header points to
+bool ChunkReader::map_split_chunk(const std::string &filename, const char *cursor, const char *limit)
+{
+    if (!map_orders(cursor, limit))
+        return false;
+
+    base_mapping = map_file(base_file_name(filename, file_header.base_stamp), base_length);
+    return base_mapping && map_base_file((const char *)base_mapping, base_length);
+}
+
+// Header and orders of an orders file
+bool ChunkReader::map_orders(const char *cursor, const char *limit)
+{
+    const char *start = cursor;
+    size_t size = header_size(((const Header *)cursor)->version);
+    if (cursor + size > limit)
+        return false;
+
+    memcpy((void *)&file_header, cursor, size);
+    if (file_header.version < ORDER_LOG_VERSION)
+        file_header.order_bytes = 0;
+    if (file_header.version < ORDER_LAYOUT_VERSION)
+        file_header.order_layout = file_header.order_bytes ? ORDER_LOG : ORDER_RECORDS;
+    cursor += size;
+
+    // an encoded log is only checked up to its last block here, and decoded by read_orders
+    if (file_header.order_layout == ORDER_LOG)
+    {
+        OrderLogTail tail;
+        if (file_header.order_bytes > (size_t)(limit - cursor))
+            return false;
+
+        order_log = Span<char>(cursor, file_header.order_bytes);
+        cursor += order_log.size();
+        if (!find_log_tail(order_log.begin(), order_log.size(), file_header.update_size, tail))
+            return false;
+    }
+    else if (file_header.order_layout == ORDER_COLUMNS)
+    {
+        if (file_header.update_size * ORDER_COLUMN_BYTES > (size_t)(limit - cursor))
+            return false;
+
+        column_list = map_columns(cursor, file_header.update_size);
+        cursor += file_header.update_size * ORDER_COLUMN_BYTES;
+    }
+    else if (file_header.order_layout == ORDER_RECORDS)
+    {
+        order_list = Span<DataOrder>((const DataOrder *)cursor, file_header.update_size);
+        cursor += order_list.size() * sizeof(DataOrder);
+    }
+    else
+        return false;
+
+    used_length = cursor - start;
+    return cursor <= limit;
+}
+
+// Base file of the stamp the orders file's header points to
+bool ChunkReader::map_base_file(const char *cursor, size_t length)
+{
+    size_t size = header_size(file_header.version);
+    if (length < size)
+        return false;
+
+    if (((const Header *)cursor)->base_stamp != file_header.base_stamp)
+    {
+        is_stale = true;
+        return false;
+    }
+
+    // the orders file's header is only rewritten in place, so the order count and layout are the
+    // parts of it the base file doesn't carry as well
+    unsigned long update_size = file_header.update_size;
+    uint64_t order_bytes = file_header.order_bytes;
+    OrderLayout order_layout = file_header.order_layout;
+    memcpy((void *)&file_header, cursor, size);
+    file_header.update_size = update_size;
+    file_header.order_bytes = order_bytes;
+    file_header.order_layout = order_layout;
+    if (file_header.version == BASE_FILE_VERSION)
+        file_header.base_ref = NO_BASE_REF;
+
+    const char *limit = cursor + length;
+    cursor += size;
+    return map_base(cursor, limit);
+}
+
+// Version 0 chunks have the same sections in the same order, only without the magic,
+// version and tick size in the header and with double prices
+bool ChunkReader::convert_legacy_chunk(const char *cursor, const char *limit, double tick_size)
+{
+    const LegacyHeader *legacy = (const LegacyHeader *)cursor;
+    cursor += sizeof(LegacyHeader);
+
+    file_header = Header(legacy->base_buy,
+                         legacy->base_sell,
+                         legacy->update_size,
+                         legacy->last_trade_qty,
+                         to_ticks(legacy->last_trade_price, tick_size),
+                         legacy->last_trade_epoch);
+    file_header.version = 0;
+    file_header.checkpoints = legacy->checkpoints;
+    file_header.tick_size = tick_size;
+
+    const LegacyCheckpoint *checkpoints = (const LegacyCheckpoint *)cursor;
+    cursor += legacy->checkpoints * sizeof(LegacyCheckpoint);
+    if (cursor > limit)
+        return false;
+
+    size_t level_count = legacy->base_buy + legacy->base_sell;
+    for (size_t idx = 0; idx < legacy->checkpoints; idx++)
+    {
+        const LegacyCheckpoint &checkpoint = checkpoints[idx];
+        converted_checkpoints.push_back({checkpoint.order_count,
+                                         checkpoint.epoch,
+                                         checkpoint.book_buy,
+                                         checkpoint.book_sell,
+                                         checkpoint.last_trade_qty,
+                                         to_ticks(checkpoint.last_trade_price, tick_size),
+                                         checkpoint.last_trade_epoch});
+        level_count += checkpoint.book_buy + checkpoint.book_sell;
+    }
+
+    // base levels and checkpoint levels are back to back
+    const LegacyEntry *levels = (const LegacyEntry *)cursor;
+    cursor += level_count * sizeof(LegacyEntry);
+    if (cursor > limit)
+        return false;
+
+    converted_levels.reserve(level_count);
+    for (size_t idx = 0; idx < level_count; idx++)
+        converted_levels.push_back(OrderEntry(levels[idx].qty, to_ticks(levels[idx].price, tick_size)));
+
+    const LegacyOrder *orders = (const LegacyOrder *)cursor;
+    cursor += legacy->update_size * sizeof(LegacyOrder);
+    if (cursor > limit)
+        return false;
+
+    converted_orders.resize(legacy->update_size);
+    for (size_t idx = 0; idx < legacy->update_size; idx++)
+    {
+        DataOrder &order = converted_orders[idx];
+        order.epoch = orders[idx].epoch;
+        order.id = orders[idx].id;
+        order.side = orders[idx].side;
+        order.category = orders[idx].category;
+        order.qty = orders[idx].qty;
+        order.price = to_ticks(orders[idx].price, tick_size);
+    }
+
+    const OrderEntry *level = converted_levels.data();
+    checkpoint_table = Span<Checkpoint>(converted_checkpoints.data(), converted_checkpoints.size());
+    buy_levels = Span<OrderEntry>(level, legacy->base_buy);
+    level += legacy->base_buy;
+    sell_levels = Span<OrderEntry>(level, legacy->base_sell);
+    level += legacy->base_sell;
+
+    for (const Checkpoint &checkpoint : converted_checkpoints)
+    {
+        checkpoint_levels.push_back(level);
+        level += checkpoint.book_buy + checkpoint.book_sell;
+    }
+
+    order_list = Span<DataOrder>(converted_orders.data(), converted_orders.size());
+    return true;
+}
+
+ChunkReader::~ChunkReader()
+{
+    release();
+}
+
+bool ChunkReader::read_orders(std::vector<DataOrder> &orders) const
+{
+    if (file_header.order_layout == ORDER_LOG)
+        return decode_order_log(order_log.begin(), order_log.size(), file_header.update_size, orders);
+
+    if (file_header.order_layout == ORDER_COLUMNS)
+    {
+        orders.resize(column_list.count);
+        load_columns(column_list, orders.data());
+        return true;
+    }
+
+    orders.assign(order_list.begin(), order_list.end());
+    return true;
+}
+
+Span<OrderEntry> ChunkReader::checkpoint_buy(size_t idx) const
+{
+    return Span<OrderEntry>(checkpoint_levels[idx], checkpoint_table[idx].book_buy);
+}
+
+Span<OrderEntry> ChunkReader::checkpoint_sell(size_t idx) const
+{
+    const Checkpoint &checkpoint = checkpoint_table[idx];
+    return Span<OrderEntry>(checkpoint_levels[idx] + checkpoint.book_buy, checkpoint.book_sell);
+}
+
+void ChunkReader::base_book(OrderBook &book, size_t depth) const
+{
+    fill_book(book, buy_levels, sell_levels, depth);
+}
+
+void ChunkReader::checkpoint_book(size_t idx, OrderBook &book) const
+{
+    fill_book(book, checkpoint_buy(idx), checkpoint_sell(idx));
+}
+
+ChunkCache::ChunkCache(size_t capacity) : capacity(capacity) {}
+
+std::shared_ptr<ChunkReader> ChunkCache::open(const std::string &filename, double legacy_tick_size)
+{
+    uint64_t invalidations;
+    {
+        std::lock_guard<std::mutex> guard(cache_mutex);
+
+        auto found = entries.find(filename);
+        if (found != entries.end())
+        {
+            lru.splice(lru.begin(), lru, found->second);
+            return found->second->second;
+        }
+
+        invalidations = invalidation_count;
+    }
+
+    // mapping and validating the file is left outside the lock, so other chunks stay readable
+    std::shared_ptr<ChunkReader> reader = std::make_shared<ChunkReader>(filename, legacy_tick_size);
+
+    // missing or partially written files are not worth keeping around
+    if (!reader->valid())
+        return reader;
+
+    std::lock_guard<std::mutex> guard(cache_mutex);
+
+    // another thread may have opened the same file meanwhile, in which case its copy is kept
+    auto found = entries.find(filename);
+    if (found != entries.end())
+    {
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second->second;
+    }
+
+    // a file rewritten while it was mapped may have been read half old, so it is not cached
+    if (invalidation_count != invalidations)
+        return reader;
+
+    lru.emplace_front(filename, reader);
+    entries[filename] = lru.begin();
+
+    if (lru.size() > capacity)
+    {
+        entries.erase(lru.back().first);
+        lru.pop_back();
+    }
+
+    return reader;
+}
+
+void ChunkCache::invalidate(const std::string &filename)
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    invalidation_count++;
+
+    auto found = entries.find(filename);
+    if (found == entries.end())
+        return;
+
+    lru.erase(found->second);
+    entries.erase(found);
+}
+
+void ChunkCache::clear()
+{
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    invalidation_count++;
+    entries.clear();
+    lru.clear();
+}
+
+bool read_keyframe(const std::string &filename, uint64_t base_stamp, OrderBook &book)
+{
+    size_t length = 0;
+    void *mapping = map_file(base_file_name(filename, base_stamp), length);
+    if (!mapping)
+        return false;
+
+    bool is_keyframe = read_keyframe((const char *)mapping, length, base_stamp, book);
+    munmap(mapping, length);
+    return is_keyframe;
+}
+
+bool read_keyframe(const char *data, size_t length, uint64_t base_stamp, OrderBook &book)
+{
+    const Header *header = (const Header *)data;
+    bool is_keyframe = length >= header_size(KEYFRAME_VERSION) &&
+                       header->version >= KEYFRAME_VERSION &&
+                       length >= header_size(header->version) &&
+                       header->base_stamp == base_stamp &&
+                       header->base_ref == NO_BASE_REF;
+    if (!is_keyframe)
+        return false;
+
+    const OrderEntry *levels = (const OrderEntry *)(data + header_size(header->version) + header->checkpoints * sizeof(Checkpoint));
+    if ((const char *)(levels + header->base_buy + header->base_sell) > data + length)
+        return false;
+
+    fill_book(book,
+              Span<OrderEntry>(levels, header->base_buy),
+              Span<OrderEntry>(levels + header->base_buy, header->base_sell));
+    return true;
+}
+
+void patch_book(OrderBook &book, Span<OrderEntry> buys, Span<OrderEntry> sells)
+{
+    for (const OrderEntry &level : buys)
+        book.buy_levels.set(level.qty, level.price);
+    for (const OrderEntry &level : sells)
+        book.sell_levels.set(level.qty, level.price);
+}
+
+// Levels are stored from the worst price to the best one, so the best depth levels
+// of a side are its last depth entries (all of them for a depth of 0)
+void fill_book(OrderBook &book, Span<OrderEntry> buys, Span<OrderEntry> sells, size_t depth)
+{
+    size_t buy_skip = depth && depth < buys.size() ? buys.size() - depth : 0;
+    size_t sell_skip = depth && depth < sells.size() ? sells.size() - depth : 0;
+    book.buy_levels.assign(buys.begin() + buy_skip, buys.end());
+    book.sell_levels.assign(sells.begin() + sell_skip, sells.end());
+}
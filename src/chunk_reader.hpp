@@ -0,0 +1,147 @@
+#ifndef ChunkReader_HPP
+#define ChunkReader_HPP
+
+#include "include/order.hpp"
+#include "include/order_book.hpp"
+#include "header.hpp"
+#include "order_columns.hpp"
+#include "segment.hpp"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+
+// Default number of chunk files kept mapped at once
+static const size_t MAPPED_CHUNKS = 256;
+
+// Times a chunk is mapped again when its base file was replaced while it was being opened
+static const int MAP_ATTEMPTS = 4;
+
+// Read-only view over a contiguous array of records inside a mapped chunk
+template <typename T>
+struct Span
+{
+    const T *ptr = nullptr;
+    size_t count = 0;
+
+    Span() {}
+    Span(const T *ptr, size_t count) : ptr(ptr), count(count) {}
+
+    inline const T *begin() const { return ptr; }
+    inline const T *end() const { return ptr + count; }
+    inline const T &operator[](size_t idx) const { return ptr[idx]; }
+    inline const T &back() const { return ptr[count - 1]; }
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+};
+
+// Zero-copy access to a chunk through mmap: every section is exposed as a typed span straight
+// into the mapping of the chunk's orders file, or of the base file its header points to, or into
+// the mapping of the segment a packed chunk was read from, which the reader holds on to.
+// The base state spans of a chunk stored against a keyframe hold only its diff (see patch_book),
+// and the orders of a chunk storing an encoded order log or columns are only exposed as those.
+// Chunks from before prices became ticks (version 0) are converted once into owned
+// copies instead, using the tick size of their symbol, and the spans point into those
+class ChunkReader
+{
+    void *mapping = nullptr;
+    size_t length = 0;
+    void *base_mapping = nullptr;
+    size_t base_length = 0;
+    std::shared_ptr<const SegmentMapping> segment;
+    size_t used_length = 0;
+    bool is_valid = false;
+    bool is_stale = false;
+
+    Header file_header;
+    Span<Checkpoint> checkpoint_table;
+    Span<OrderEntry> buy_levels;
+    Span<OrderEntry> sell_levels;
+    Span<DataOrder> order_list;
+    Span<char> order_log;
+    OrderColumns column_list;
+    std::vector<const OrderEntry *> checkpoint_levels;
+
+    // only used for version 0 chunks
+    std::vector<Checkpoint> converted_checkpoints;
+    std::vector<OrderEntry> converted_levels;
+    std::vector<DataOrder> converted_orders;
+
+    void open(const std::string &filename, double legacy_tick_size);
+    void release();
+    bool map_base(const char *&cursor, const char *limit);
+    bool map_chunk(const char *cursor, const char *limit);
+    bool map_split_chunk(const std::string &filename, const char *cursor, const char *limit);
+    bool map_orders(const char *cursor, const char *limit);
+    bool map_base_file(const char *cursor, size_t length);
+    bool convert_legacy_chunk(const char *cursor, const char *limit, double tick_size);
+
+public:
+    ChunkReader(const std::string &filename, double legacy_tick_size);
+    ChunkReader(const PackedChunk &packed);
+    ~ChunkReader();
+
+    ChunkReader(const ChunkReader &) = delete;
+    ChunkReader &operator=(const ChunkReader &) = delete;
+
+    // false if the file is missing or shorter than its header claims
+    inline bool valid() const { return is_valid; }
+
+    inline const Header &header() const { return file_header; }
+    // bytes of the orders file covered by its header, where appended orders go (0 for version 0 chunks)
+    inline size_t data_length() const { return used_length; }
+    inline Span<Checkpoint> checkpoints() const { return checkpoint_table; }
+    inline Span<OrderEntry> base_buy() const { return buy_levels; }
+    inline Span<OrderEntry> base_sell() const { return sell_levels; }
+    // raw order records, empty for chunks storing an encoded order log or columns
+    inline Span<DataOrder> orders() const { return order_list; }
+    inline Span<char> encoded_orders() const { return order_log; }
+    inline const OrderColumns &columns() const { return column_list; }
+    // copies the orders out, decoding an encoded log. False if it is damaged
+    bool read_orders(std::vector<DataOrder> &orders) const;
+    Span<OrderEntry> checkpoint_buy(size_t idx) const;
+    Span<OrderEntry> checkpoint_sell(size_t idx) const;
+
+    void base_book(OrderBook &book, size_t depth = 0) const;
+    void checkpoint_book(size_t idx, OrderBook &book) const;
+};
+
+// LRU cache of chunk mappings keyed by chunk path. Readers hold on to a shared mapping,
+// so invalidating an entry never unmaps a chunk that is still being read
+class ChunkCache
+{
+    typedef std::pair<std::string, std::shared_ptr<ChunkReader>> cache_entry;
+
+    std::mutex cache_mutex;
+    size_t capacity;
+    // bumped by every invalidation, so readers built meanwhile are not cached
+    uint64_t invalidation_count = 0;
+    std::list<cache_entry> lru;
+    std::unordered_map<std::string, std::list<cache_entry>::iterator> entries;
+
+public:
+    ChunkCache(size_t capacity);
+
+    // the tick size is only used to convert chunks from before prices became ticks
+    std::shared_ptr<ChunkReader> open(const std::string &filename, double legacy_tick_size);
+    void invalidate(const std::string &filename);
+    void clear();
+};
+
+void fill_book(OrderBook &book, Span<OrderEntry> buys, Span<OrderEntry> sells, size_t depth = 0);
+
+// Whole base state stored in the chunk's base file of the given stamp. False if that file was
+// replaced since, or only holds a diff itself
+bool read_keyframe(const std::string &filename, uint64_t base_stamp, OrderBook &book);
+// Same for the length bytes of a base file at data
+bool read_keyframe(const char *data, size_t length, uint64_t base_stamp, OrderBook &book);
+
+// Applies a stored diff to the keyframe's book: every level takes the diff's quantity, and
+// levels with a quantity of 0 are removed
+void patch_book(OrderBook &book, Span<OrderEntry> buys, Span<OrderEntry> sells);
+
+#endif
@@ -0,0 +1,347 @@
+#include "chunk_writer.hpp"
+#include "order_columns.hpp"
+#include "order_log.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static inline void append(std::vector<char> &buffer, const void *data, size_t length)
+{
+    if (length == 0)
+        return;
+
+    size_t offset = buffer.size();
+    buffer.resize(offset + length);
+    memcpy(buffer.data() + offset, data, length);
+}
+
+// The buffers keep their capacity between chunks, so steady state ingestion doesn't allocate
+void serialize_orders(std::vector<char> &buffer, Header &header, const std::vector<DataOrder> &orders, OrderLayout layout)
+{
+    buffer.clear();
+    header.order_bytes = 0;
+    header.order_layout = layout;
+    if (layout == ORDER_RECORDS)
+    {
+        buffer.reserve(sizeof(Header) + orders.size() * sizeof(DataOrder));
+        append(buffer, &header, sizeof(Header));
+        append(buffer, orders.data(), orders.size() * sizeof(DataOrder));
+        return;
+    }
+
+    // the header is filled in once the length of the orders is known
+    buffer.resize(sizeof(Header));
+    if (layout == ORDER_LOG)
+        encode_order_log(buffer, orders.data(), orders.size());
+    else
+    {
+        buffer.resize(sizeof(Header) + orders.size() * ORDER_COLUMN_BYTES);
+        store_columns(buffer.data() + sizeof(Header), orders.data(), orders.size());
+    }
+
+    header.order_bytes = buffer.size() - sizeof(Header);
+    memcpy(buffer.data(), &header, sizeof(Header));
+}
+
+void serialize_base(std::vector<char> &buffer,
+                    const Header &header,
+                    const std::vector<OrderEntry> &buys,
+                    const std::vector<OrderEntry> &sells,
+                    const std::vector<Checkpoint> &checkpoints,
+                    const std::vector<OrderEntry> &checkpoint_levels)
+{
+    buffer.clear();
+    buffer.reserve(sizeof(Header) +
+                   checkpoints.size() * sizeof(Checkpoint) +
+                   (buys.size() + sells.size() + checkpoint_levels.size()) * sizeof(OrderEntry));
+
+    append(buffer, &header, sizeof(Header));
+    append(buffer, checkpoints.data(), checkpoints.size() * sizeof(Checkpoint));
+    append(buffer, buys.data(), buys.size() * sizeof(OrderEntry));
+    append(buffer, sells.data(), sells.size() * sizeof(OrderEntry));
+    append(buffer, checkpoint_levels.data(), checkpoint_levels.size() * sizeof(OrderEntry));
+}
+
+std::string temp_chunk_name(const std::string &filename)
+{
+    return filename.substr(0, filename.size() - 4) + TMP;
+}
+
+std::string base_file_name(const std::string &filename, uint64_t base_stamp)
+{
+    return filename.substr(0, filename.size() - 4) + BASE_SLOT + std::to_string(base_stamp % 2) + ".dat";
+}
+
+bool parse_chunk_header(const char *data, size_t length, Header &header)
+{
+    memcpy((void *)&header, data, std::min(length, sizeof(Header)));
+    if (length < offsetof(Header, delta_seq) || header.magic != CHUNK_MAGIC ||
+        header.version < BASE_FILE_VERSION || length < header_size(header.version))
+        return false;
+
+    if (header.version == BASE_FILE_VERSION)
+        header.base_ref = NO_BASE_REF;
+    if (header.version < ORDER_LOG_VERSION)
+        header.order_bytes = 0;
+    if (header.version < ORDER_LAYOUT_VERSION)
+        header.order_layout = header.order_bytes ? ORDER_LOG : ORDER_RECORDS;
+
+    return true;
+}
+
+bool read_chunk_header(const std::string &filename, Header &header)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    char data[sizeof(Header)];
+    ssize_t length = pread(fd, data, sizeof(Header), 0);
+    ::close(fd);
+
+    return length >= 0 && parse_chunk_header(data, length, header);
+}
+
+uint64_t current_base_stamp(const std::string &filename)
+{
+    Header header;
+    return read_chunk_header(filename, header) ? header.base_stamp : 0;
+}
+
+bool write_fully(int fd, const char *data, size_t length, off_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0)
+            return false;
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+bool stage_chunk_file(const std::string &filename, const std::vector<char> &buffer)
+{
+    std::string tmp_name = temp_chunk_name(filename);
+    int fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+
+    bool is_written = write_fully(fd, buffer.data(), buffer.size(), 0);
+    ::close(fd);
+
+    if (!is_written)
+        ::unlink(tmp_name.c_str());
+
+    return is_written;
+}
+
+bool commit_chunk_file(const std::string &filename)
+{
+    std::string tmp_name = temp_chunk_name(filename);
+    if (std::rename(tmp_name.c_str(), filename.c_str()) != 0)
+    {
+        ::unlink(tmp_name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void discard_chunk_file(const std::string &filename)
+{
+    ::unlink(temp_chunk_name(filename).c_str());
+}
+
+static std::string backup_chunk_name(const std::string &filename)
+{
+    return filename.substr(0, filename.size() - 4) + BACKUP;
+}
+
+bool backup_chunk_file(const std::string &filename)
+{
+    // a backup left by an interrupted commit is stale
+    std::string backup_name = backup_chunk_name(filename);
+    ::unlink(backup_name.c_str());
+    return ::link(filename.c_str(), backup_name.c_str()) == 0;
+}
+
+bool restore_chunk_file(const std::string &filename)
+{
+    return std::rename(backup_chunk_name(filename).c_str(), filename.c_str()) == 0;
+}
+
+void drop_chunk_backup(const std::string &filename)
+{
+    ::unlink(backup_chunk_name(filename).c_str());
+}
+
+bool write_chunk_file(const std::string &filename, const std::vector<char> &buffer)
+{
+    return stage_chunk_file(filename, buffer) && commit_chunk_file(filename);
+}
+
+bool write_base_file(const std::string &filename,
+                     Header &header,
+                     const std::vector<OrderEntry> &buys,
+                     const std::vector<OrderEntry> &sells,
+                     const std::vector<Checkpoint> &checkpoints,
+                     const std::vector<OrderEntry> &checkpoint_levels,
+                     std::vector<char> &buffer)
+{
+    header.base_stamp = current_base_stamp(filename) + 1;
+    serialize_base(buffer, header, buys, sells, checkpoints, checkpoint_levels);
+    return write_chunk_file(base_file_name(filename, header.base_stamp), buffer);
+}
+
+bool patch_header(const std::string &filename, const Header &header)
+{
+    int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    bool is_written = write_fully(fd, (const char *)&header, sizeof(Header), 0);
+    ::close(fd);
+    return is_written;
+}
+
+bool append_chunk_orders(const std::string &filename, size_t offset, const DataOrder *orders, size_t count, const Header &header)
+{
+    int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    bool is_written = write_fully(fd, (const char *)orders, count * sizeof(DataOrder), offset) &&
+                      write_fully(fd, (const char *)&header, sizeof(Header), 0);
+    ::close(fd);
+    return is_written;
+}
+
+bool append_chunk_log(const std::string &filename,
+                      size_t offset,
+                      const std::vector<char> &encoded,
+                      size_t block_offset,
+                      const OrderBlock &block,
+                      const Header &header)
+{
+    int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    bool is_written = write_fully(fd, encoded.data(), encoded.size(), offset) &&
+                      (block.count == 0 || write_fully(fd, (const char *)&block, sizeof(OrderBlock), block_offset)) &&
+                      write_fully(fd, (const char *)&header, sizeof(Header), 0);
+    ::close(fd);
+    return is_written;
+}
+
+ChunkWriter::ChunkWriter(size_t depth, OrderLayout layout)
+    : slots(depth ? depth : 1), ring(slots.size()), layout(layout) {}
+
+ChunkWriter::~ChunkWriter()
+{
+    wait_all();
+}
+
+void ChunkWriter::submit(const std::string &filename,
+                         Header &header,
+                         const std::vector<OrderEntry> &buys,
+                         const std::vector<OrderEntry> &sells,
+                         const std::vector<Checkpoint> &checkpoints,
+                         const std::vector<OrderEntry> &checkpoint_levels,
+                         const std::vector<DataOrder> &orders,
+                         std::function<void(bool)> on_written)
+{
+    size_t idx = 0;
+    while (true)
+    {
+        for (idx = 0; idx < slots.size() && slots[idx].is_busy; idx++)
+            ;
+
+        if (idx < slots.size() || !wait_one())
+            break;
+    }
+
+    // every slot is stuck behind a broken ring, so the chunk can only fail
+    if (idx == slots.size())
+    {
+        on_written(false);
+        return;
+    }
+
+    Slot &slot = slots[idx];
+    if (!write_base_file(filename, header, buys, sells, checkpoints, checkpoint_levels, slot.base_buffer))
+    {
+        on_written(false);
+        return;
+    }
+
+    serialize_orders(slot.buffer, header, orders, layout);
+    slot.filename = filename;
+    slot.tmp_name = temp_chunk_name(filename);
+    slot.on_written = on_written;
+    slot.fd = ::open(slot.tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (slot.fd < 0)
+    {
+        slot.on_written(false);
+        return;
+    }
+
+    slot.is_busy = true;
+    if (ring.valid() && ring.write(slot.fd, slot.buffer.data(), slot.buffer.size(), 0, idx))
+    {
+        in_flight++;
+        return;
+    }
+
+    // no io_uring (or its queue is unusable): write synchronously
+    complete(slot, 0);
+}
+
+// Finishes a write that wrote result bytes (or failed with a negative result)
+void ChunkWriter::complete(Slot &slot, int result)
+{
+    bool is_written = result >= 0 &&
+                      write_fully(slot.fd, slot.buffer.data() + result, slot.buffer.size() - result, result);
+    ::close(slot.fd);
+    slot.fd = -1;
+
+    if (!is_written || std::rename(slot.tmp_name.c_str(), slot.filename.c_str()) != 0)
+    {
+        ::unlink(slot.tmp_name.c_str());
+        is_written = false;
+    }
+
+    slot.is_busy = false;
+    std::function<void(bool)> on_written = std::move(slot.on_written);
+    on_written(is_written);
+}
+
+bool ChunkWriter::wait_one()
+{
+    if (in_flight == 0)
+        return false;
+
+    uint64_t tag;
+    int result;
+    if (!ring.wait(tag, result))
+        return false;
+
+    in_flight--;
+    complete(slots[tag], result);
+    return true;
+}
+
+void ChunkWriter::wait_all()
+{
+    while (in_flight > 0 && wait_one())
+        ;
+}
@@ -0,0 +1,142 @@
+#ifndef ChunkWriter_HPP
+#define ChunkWriter_HPP
+
+#include "include/order.hpp"
+#include "include/order_book.hpp"
+#include "header.hpp"
+#include "order_log.hpp"
+#include "uring.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <sys/types.h>
+
+static const std::string TMP = "_TMP.dat";
+static const std::string BACKUP = "_BAK.dat";
+static const std::string BASE_SLOT = "_BASE";
+
+// Default number of chunk writes ingestion keeps in flight
+static const size_t WRITE_DEPTH = 4;
+
+// Lays the orders file of a chunk out in the buffer: its header, then the orders in the layout,
+// which it records in the header along with the length of an encoded log or of the columns
+void serialize_orders(std::vector<char> &buffer, Header &header, const std::vector<DataOrder> &orders, OrderLayout layout);
+
+// Lays the base file of a chunk out in the buffer: its header, the checkpoint table, the stored
+// base state and the checkpoint levels (the header has to carry the section sizes)
+void serialize_base(std::vector<char> &buffer,
+                    const Header &header,
+                    const std::vector<OrderEntry> &buys,
+                    const std::vector<OrderEntry> &sells,
+                    const std::vector<Checkpoint> &checkpoints,
+                    const std::vector<OrderEntry> &checkpoint_levels);
+
+std::string temp_chunk_name(const std::string &filename);
+
+// Base file of the chunk with the given stamp. Stamps alternate between two files, so the one
+// the orders file points to is never overwritten
+std::string base_file_name(const std::string &filename, uint64_t base_stamp);
+
+// Header of the chunk's orders file, with one positioned read. False if it is missing, or in a
+// format from before base files
+bool read_chunk_header(const std::string &filename, Header &header);
+// Same for the first length bytes of an orders file
+bool parse_chunk_header(const char *data, size_t length, Header &header);
+
+// Stamp of the base file the chunk's orders file points to, 0 if it has none (missing, or in a
+// format from before base files)
+uint64_t current_base_stamp(const std::string &filename);
+
+// Writes the base file for the next stamp of the chunk, and gives the header that stamp.
+// Readers only switch to it once the orders file's header carries the stamp too
+bool write_base_file(const std::string &filename,
+                     Header &header,
+                     const std::vector<OrderEntry> &buys,
+                     const std::vector<OrderEntry> &sells,
+                     const std::vector<Checkpoint> &checkpoints,
+                     const std::vector<OrderEntry> &checkpoint_levels,
+                     std::vector<char> &buffer);
+
+// pwrite until everything is written, as a single call may write less
+bool write_fully(int fd, const char *data, size_t length, off_t offset);
+
+// Writes the buffer into a temporary file with positioned writes, then renames it in place
+bool write_chunk_file(const std::string &filename, const std::vector<char> &buffer);
+
+// The two halves of write_chunk_file, for writers that swap several chunks in together.
+// A staged chunk is dropped with discard_chunk_file instead of being committed
+bool stage_chunk_file(const std::string &filename, const std::vector<char> &buffer);
+bool commit_chunk_file(const std::string &filename);
+void discard_chunk_file(const std::string &filename);
+
+// Keeps the chunk's current orders file under a second name while a staged one is committed over
+// it, so the commit can be undone with restore_chunk_file, or made final with drop_chunk_backup
+bool backup_chunk_file(const std::string &filename);
+bool restore_chunk_file(const std::string &filename);
+void drop_chunk_backup(const std::string &filename);
+
+// Overwrites only the header of a chunk, with one positioned write
+bool patch_header(const std::string &filename, const Header &header);
+
+// Writes the orders at the offset of the chunk, then its header carrying the new order count,
+// so a chunk cut off in between still reads as before the append
+bool append_chunk_orders(const std::string &filename, size_t offset, const DataOrder *orders, size_t count, const Header &header);
+
+// Same for a chunk storing an encoded order log: the encoded orders go at the offset, then the
+// header of the log's last block they were added to (unless its count is 0), then the header
+bool append_chunk_log(const std::string &filename,
+                      size_t offset,
+                      const std::vector<char> &encoded,
+                      size_t block_offset,
+                      const OrderBlock &block,
+                      const Header &header);
+
+// Writes whole chunks from reusable buffers, keeping up to depth writes of orders files in flight
+// through io_uring where available. Base files are small and written within submit, as are
+// orders files without io_uring. Completion callbacks run on the submitting thread, once the
+// orders file was renamed in place
+class ChunkWriter
+{
+    struct Slot
+    {
+        std::vector<char> buffer;
+        std::vector<char> base_buffer;
+        std::string filename;
+        std::string tmp_name;
+        int fd = -1;
+        bool is_busy = false;
+        std::function<void(bool)> on_written;
+    };
+
+    std::vector<Slot> slots;
+    size_t in_flight = 0;
+    Uring ring;
+    OrderLayout layout;
+
+    void complete(Slot &slot, int result);
+    bool wait_one();
+
+public:
+    // orders files are written in the given layout
+    ChunkWriter(size_t depth, OrderLayout layout);
+    ~ChunkWriter();
+
+    ChunkWriter(const ChunkWriter &) = delete;
+    ChunkWriter &operator=(const ChunkWriter &) = delete;
+
+    // blocks while every slot is in flight, and gives the header its base stamp and order layout
+    void submit(const std::string &filename,
+                Header &header,
+                const std::vector<OrderEntry> &buys,
+                const std::vector<OrderEntry> &sells,
+                const std::vector<Checkpoint> &checkpoints,
+                const std::vector<OrderEntry> &checkpoint_levels,
+                const std::vector<DataOrder> &orders,
+                std::function<void(bool)> on_written);
+    void wait_all();
+
+    inline bool uses_io_uring() const { return ring.valid(); }
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "delta_log.hpp"
+#include "include/config.hpp"
+#include "shared.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+
+DeltaLog::DeltaLog(const std::string &filename) : filename(filename)
+{
+    load();
+}
+
+DeltaLog::~DeltaLog()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+// The file is only created by the first change, so reading a symbol leaves nothing behind
+void DeltaLog::load()
+{
+    fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0)
+        return;
+
+    if (pread(fd, &last_seq, sizeof(uint64_t), 0) != sizeof(uint64_t))
+        last_seq = 0;
+
+    DeltaRecord record;
+    off_t length = sizeof(uint64_t);
+    while (pread(fd, &record, sizeof(DeltaRecord), length) == sizeof(DeltaRecord))
+    {
+        records.push_back(record);
+        last_seq = std::max(last_seq, record.seq);
+        length += sizeof(DeltaRecord);
+    }
+
+    // a record cut off by a crash belongs to a change that never finished
+    if (ftruncate(fd, length) != 0)
+        return;
+}
+
+bool DeltaLog::append(const std::vector<Order> &orders)
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    if (fd < 0)
+    {
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd < 0 || pwrite(fd, &last_seq, sizeof(uint64_t), 0) != sizeof(uint64_t))
+            return false;
+    }
+
+    // the orders of one change share a number, so a chunk never carries half of it
+    off_t length = sizeof(uint64_t) + records.size() * sizeof(DeltaRecord);
+    std::vector<DeltaRecord> appended;
+    for (Order order : orders)
+        appended.push_back(DeltaRecord{last_seq + 1, DataOrder(order)});
+
+    size_t bytes = appended.size() * sizeof(DeltaRecord);
+    if (pwrite(fd, appended.data(), bytes, length) != (ssize_t)bytes)
+        return false;
+
+    last_seq++;
+    records.insert(records.end(), appended.begin(), appended.end());
+    return true;
+}
+
+uint64_t DeltaLog::collect(uint64_t window, uint64_t after_seq, BaseShift &shift)
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+
+    auto record = std::upper_bound(records.begin(), records.end(), after_seq,
+                                   [](uint64_t seq, const DeltaRecord &record)
+                                   { return seq < record.seq; });
+    for (; record != records.end(); record++)
+        if (record->order.epoch < window)
+        {
+            const DataOrder &order = record->order;
+            shift.add(Order("", order.epoch, order.id, order.side, order.category, order.qty, order.price));
+        }
+
+    return last_seq;
+}
+
+uint64_t DeltaLog::sequence()
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    return last_seq;
+}
+
+size_t DeltaLog::size()
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    return records.size();
+}
+
+uint64_t DeltaLog::first_epoch()
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+
+    uint64_t first = records.front().order.epoch;
+    for (DeltaRecord &record : records)
+        first = std::min(first, record.order.epoch);
+
+    return first;
+}
+
+void DeltaLog::trim(const std::function<void()> &on_trimmed)
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    if (fd < 0 || records.empty())
+        return;
+
+    // the number is kept first, so a crash in between leaves records the chunks already carry
+    if (pwrite(fd, &last_seq, sizeof(uint64_t), 0) != sizeof(uint64_t) || ftruncate(fd, sizeof(uint64_t)) != 0)
+        return;
+
+    records.clear();
+    trim_count++;
+    on_trimmed();
+}
+
+uint64_t DeltaLog::trims()
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    return trim_count;
+}
+
+bool DeltaLog::unless_trimmed(uint64_t trims, const std::function<void()> &action)
+{
+    std::lock_guard<std::mutex> guard(log_mutex);
+    if (trim_count != trims)
+        return false;
+
+    action();
+    return true;
+}
+
+DeltaLogs::DeltaLogs(Config *conf) : conf(conf) {}
+
+DeltaLogs::~DeltaLogs()
+{
+    {
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        is_stopping = true;
+    }
+
+    wake.notify_one();
+    if (compactor.joinable())
+        compactor.join();
+}
+
+DeltaLog &DeltaLogs::log(const std::string &symbol)
+{
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    std::unique_ptr<DeltaLog> &entry = logs[symbol];
+    if (!entry)
+        entry = std::make_unique<DeltaLog>(conf->data_dir + symbol + "/" + DELTA);
+
+    return *entry;
+}
+
+void DeltaLogs::append(const std::string &symbol, uint64_t epoch, const std::vector<Order> &orders)
+{
+    // nothing after the epoch's window has a base state to change
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    if (idx->successor(generate_epoch_window(conf, epoch)) == AVL_EMPTY_NODE)
+        return;
+
+    DeltaLog &symbol_log = log(symbol);
+    if (!symbol_log.append(orders))
+    {
+        // without the log, the change is written into the later chunks right away
+        BaseShift shift;
+        for (const Order &order : orders)
+            shift.add(order);
+
+        reconfig_ahead(conf, epoch, symbol, shift);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    if (!compactor.joinable() && !is_stopping)
+        compactor = std::thread(&DeltaLogs::run_compactor, this);
+
+    if (symbol_log.size() >= conf->delta_compact_records)
+        wake.notify_one();
+}
+
+void DeltaLogs::compact(const std::string &symbol)
+{
+    DeltaLog &symbol_log = log(symbol);
+    if (symbol_log.size() == 0)
+        return;
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    uint64_t last_seq = symbol_log.sequence();
+    uint64_t file_epoch = idx->successor(generate_epoch_window(conf, symbol_log.first_epoch()));
+
+    std::vector<uint64_t> affected;
+    std::vector<uint64_t> file_epochs;
+    for (; file_epoch != AVL_EMPTY_NODE; file_epoch = idx->successor(file_epoch))
+    {
+        affected.push_back(file_epoch);
+
+        // chunks rewritten since the last change already carry everything
+        std::shared_ptr<ChunkReader> reader = open_chunk(conf, symbol, file_epoch);
+        if (!reader->valid() || reader->header().version != CHUNK_VERSION || reader->header().delta_seq < last_seq)
+            file_epochs.push_back(file_epoch);
+    }
+
+    // the chunks are read with the changes folded in, so there is nothing left to shift by.
+    // The log is kept if any of them could not be written
+    if (!shift_chunks(conf, symbol, file_epochs, BaseShift()))
+        return;
+
+    // a query may have cached a chunk it read before it was rewritten, with only the changes
+    // logged by then folded in. Queries stop caching once the log is trimmed, so whatever they
+    // cached before is dropped along with the log
+    symbol_log.trim([&]()
+                    {
+                        for (uint64_t epoch : affected)
+                            conf->decoded.invalidate(symbol, epoch);
+                    });
+}
+
+void DeltaLogs::compact_all()
+{
+    std::vector<std::string> symbols;
+    {
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        for (auto &entry : logs)
+            symbols.push_back(entry.first);
+    }
+
+    for (std::string &symbol : symbols)
+    {
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+        compact(symbol);
+    }
+}
+
+// Compacts every log that is due, and all non-empty ones on each interval
+void DeltaLogs::run_compactor()
+{
+    std::chrono::steady_clock::time_point last_compaction = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(registry_mutex);
+
+    while (!is_stopping)
+    {
+        std::chrono::milliseconds interval(COMPACT_INTERVAL_MS);
+        wake.wait_for(guard, interval);
+        if (is_stopping)
+            break;
+
+        bool is_interval = std::chrono::steady_clock::now() - last_compaction >= interval;
+        std::vector<std::string> symbols;
+        for (auto &entry : logs)
+        {
+            size_t size = entry.second->size();
+            if (size > 0 && (is_interval || size >= conf->delta_compact_records))
+                symbols.push_back(entry.first);
+        }
+
+        if (is_interval)
+            last_compaction = std::chrono::steady_clock::now();
+
+        // symbol locks are taken without the registry mutex, which writers take under theirs
+        guard.unlock();
+        for (std::string &symbol : symbols)
+        {
+            std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+            compact(symbol);
+        }
+        guard.lock();
+    }
+}
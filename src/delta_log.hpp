@@ -0,0 +1,109 @@
+#ifndef DeltaLog_HPP
+#define DeltaLog_HPP
+
+#include "include/order.hpp"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+struct Config;
+struct BaseShift;
+
+static const std::string DELTA = "DELTA.dat";
+
+// Suggested number of logged base state changes of a symbol that makes the compactor fold them
+// into the chunks, and the interval it folds every non-empty log on regardless
+static const size_t DELTA_COMPACT_RECORDS = 256;
+static const unsigned int COMPACT_INTERVAL_MS = 10000;
+
+// Change to the base state of every chunk after the order's epoch, numbered in the order it was
+// logged. A chunk's header records the last number already folded into its base state
+struct DeltaRecord
+{
+    uint64_t seq;
+    DataOrder order;
+};
+
+// Base state changes of one symbol that are not written into the chunks after them yet.
+// The file starts with the last number handed out, so numbering carries on after a trim
+class DeltaLog
+{
+    std::mutex log_mutex;
+    std::string filename;
+    int fd = -1;
+    std::vector<DeltaRecord> records;
+    uint64_t last_seq = 0;
+    uint64_t trim_count = 0;
+
+    void load();
+
+public:
+    DeltaLog(const std::string &filename);
+    ~DeltaLog();
+
+    DeltaLog(const DeltaLog &) = delete;
+    DeltaLog &operator=(const DeltaLog &) = delete;
+
+    // logs the orders as one change, with the symbol's lock held by the caller
+    bool append(const std::vector<Order> &orders);
+
+    // adds every change numbered after the given one that lands before the window to the shift,
+    // returning the last number handed out
+    uint64_t collect(uint64_t window, uint64_t after_seq, BaseShift &shift);
+
+    uint64_t sequence();
+    size_t size();
+    // epoch of the earliest logged change, with at least one logged
+    uint64_t first_epoch();
+
+    // drops every change once all of them are in the chunks, running the action in the same step
+    void trim(const std::function<void()> &on_trimmed);
+
+    // times the log was trimmed. A chunk read before a trim may lack changes the log no longer
+    // has, so readers compare it against the count from before they read the chunk
+    uint64_t trims();
+    // runs the action unless the log was trimmed since the count, as one step with trimming
+    bool unless_trimmed(uint64_t trims, const std::function<void()> &action);
+};
+
+// Delta logs of every symbol. Historical inserts, updates and deletes log their effect on the
+// base states of later chunks instead of rewriting all of them, and queries fold the changes a
+// chunk is missing into its base state when it is loaded. A background thread writes the changes
+// into the chunks once a log holds Config::delta_compact_records of them, and every compact interval
+class DeltaLogs
+{
+    Config *conf;
+    std::mutex registry_mutex;
+    std::unordered_map<std::string, std::unique_ptr<DeltaLog>> logs;
+
+    std::thread compactor;
+    std::condition_variable wake;
+    bool is_stopping = false;
+
+    void run_compactor();
+
+public:
+    DeltaLogs(Config *conf);
+    ~DeltaLogs();
+
+    DeltaLogs(const DeltaLogs &) = delete;
+    DeltaLogs &operator=(const DeltaLogs &) = delete;
+
+    DeltaLog &log(const std::string &symbol);
+
+    // logs the orders' effect on the chunks after their epoch, with the symbol's lock held by the caller
+    void append(const std::string &symbol, uint64_t epoch, const std::vector<Order> &orders);
+
+    // writes the logged changes into every chunk still missing them, then trims the log.
+    // The symbol's lock has to be held by the caller
+    void compact(const std::string &symbol);
+    void compact_all();
+};
+
+#endif
@@ -1,16 +1,52 @@
 #ifndef Header_HPP
 #define Header_HPP
 
+#include "include/price.hpp"
+#include <stddef.h>
 #include <stdint.h>
 
+// Chunks written before prices became ticks have no magic, and are read as version 0.
+// Version 1 chunks have no delta sequence in their header, and version 1 and 2 chunks keep their
+// base state and checkpoints in the same file as the orders, with no base stamp in their header.
+// Version 3 chunks always store their whole base state, with no keyframe in their header, and
+// version 4 chunks always store their orders as raw records. Version 5 chunks have no order layout
+// in their header, and store an encoded log wherever they have an order log length
+static const uint32_t CHUNK_MAGIC = 0x4B4E4843; // "CHNK"
+static const uint32_t CHUNK_VERSION = 6;
+static const uint32_t BASE_FILE_VERSION = 3;
+static const uint32_t KEYFRAME_VERSION = 4;
+static const uint32_t ORDER_LOG_VERSION = 5;
+static const uint32_t ORDER_LAYOUT_VERSION = 6;
+
+// Keyframe of chunks that store their whole base state
+static const uint64_t NO_BASE_REF = UINT64_MAX;
+
+// Ways the orders of an orders file are stored after its header
+enum OrderLayout : uint64_t
+{
+    ORDER_RECORDS, // raw records
+    ORDER_LOG,     // an encoded log (see order_log.hpp)
+    ORDER_COLUMNS, // one column per field (see order_columns.hpp)
+};
+
 struct Header
 {
+    uint32_t magic;
+    uint32_t version;
     unsigned long base_buy;
     unsigned long base_sell;
     unsigned long update_size;
     unsigned long last_trade_qty;
-    double last_trade_price;
+    Price last_trade_price;
     uint64_t last_trade_epoch;
+    unsigned long checkpoints;
+    double tick_size; // size of one price tick of the symbol when the chunk was written
+    uint64_t delta_seq; // last change of the symbol's delta log already in the base state
+    uint64_t base_stamp; // base file the orders belong with, bumped every time it is rewritten
+    uint64_t base_ref; // window of the keyframe the base state is stored as a diff against
+    uint64_t ref_stamp; // base stamp of the keyframe the diff was taken against
+    uint64_t order_bytes; // length of the encoded order log or the columns, 0 for raw records
+    OrderLayout order_layout;
 
     Header() {}
 
@@ -18,14 +54,54 @@ struct Header
            unsigned int base_sell,
            unsigned int update_size,
            unsigned long last_trade_qty,
-           double last_trade_price,
+           Price last_trade_price,
            uint64_t last_trade_epoch)
-        : base_buy(base_buy),
+        : magic(CHUNK_MAGIC),
+          version(CHUNK_VERSION),
+          base_buy(base_buy),
           base_sell(base_sell),
           update_size(update_size),
           last_trade_qty(last_trade_qty),
           last_trade_price(last_trade_price),
-          last_trade_epoch(last_trade_epoch) {}
+          last_trade_epoch(last_trade_epoch),
+          checkpoints(0),
+          tick_size(DEFAULT_TICK_SIZE),
+          delta_seq(0),
+          base_stamp(0),
+          base_ref(NO_BASE_REF),
+          ref_stamp(0),
+          order_bytes(0),
+          order_layout(ORDER_RECORDS) {}
+};
+
+// Headers of older versions are the current one cut off before the fields that came after them
+inline size_t header_size(uint32_t version)
+{
+    if (version == 1)
+        return offsetof(Header, delta_seq);
+    if (version == 2)
+        return offsetof(Header, base_stamp);
+    if (version == 3)
+        return offsetof(Header, base_ref);
+    if (version == 4)
+        return offsetof(Header, order_bytes);
+    if (version == 5)
+        return offsetof(Header, order_layout);
+
+    return sizeof(Header);
+}
+
+// Entry of the checkpoint table that follows the header: a snapshot of the book
+// after the first order_count orders of the chunk were applied to its base state
+struct Checkpoint
+{
+    unsigned long order_count;
+    uint64_t epoch; // epoch of the last applied order
+    unsigned long book_buy;
+    unsigned long book_sell;
+    unsigned long last_trade_qty;
+    Price last_trade_price;
+    uint64_t last_trade_epoch;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,5 @@
 #include "indexer.hpp"
+#include <algorithm>
 #include <filesystem>
 #include <thread>
 #include <string>
@@ -6,8 +7,8 @@
 #include <fstream>
 #include <mutex>
 
-EpochIndexer::EpochIndexer(std::string symbol, std::string data_dir, uint64_t epoch_window)
-    : symbol(symbol), data_dir(data_dir), epoch_window(epoch_window)
+EpochIndexer::EpochIndexer(std::string symbol, std::string data_dir, uint64_t epoch_window, double tick_size, unsigned int keyframe_windows)
+    : symbol(symbol), data_dir(data_dir), epoch_window(epoch_window), tick_size(tick_size), keyframe_windows(keyframe_windows)
 {
     read();
 }
@@ -58,7 +59,42 @@ void EpochIndexer::read()
             epoch_set.insert(new_node);
     }
 
-    avl_tree.deserialize(nodes);
+    // indexes written before prices became ticks end right after the nodes
+    double stored_tick;
+    if (fin.read((char *)&stored_tick, sizeof(double)))
+        tick_size = stored_tick;
+
+    // and indexes written before keyframes after the tick size, with every base state stored whole
+    unsigned int stored_keyframes;
+    if (fin.read((char *)&stored_keyframes, sizeof(unsigned int)))
+        keyframe_windows = stored_keyframes;
+
+    // inserted one by one, so that the counts and heights of the nodes are rebuilt too
+    for (uint64_t node : nodes)
+        if (node != AVL_EMPTY_NODE)
+            avl_tree.insert(node);
+
+    read_segments(sub_dir);
+}
+
+// Locations of the indexed chunks packed into segments. A chunk that has files of its own as well
+// was unpacked or packed again when the table was last written, and is read from those
+void EpochIndexer::read_segments(const std::string &sub_dir)
+{
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(sub_dir))
+    {
+        std::string filename = entry.path().filename().string();
+        if (filename.size() <= SEGMENT.size() || filename.compare(filename.size() - SEGMENT.size(), SEGMENT.size(), SEGMENT) != 0)
+            continue;
+
+        std::vector<SegmentEntry> table;
+        if (!read_segment_table(entry.path().string(), table))
+            continue;
+
+        for (const SegmentEntry &packed : table)
+            if (epoch_set.count(packed.window) && !std::filesystem::exists(sub_dir + std::to_string(packed.window) + ".dat"))
+                locations[packed.window] = packed.location;
+    }
 }
 
 void EpochIndexer::flush()
@@ -71,12 +107,15 @@ void EpochIndexer::flush()
 
     fout.write((char *)&epoch_window, sizeof(uint64_t));
 
-    idx_header tree_size = avl_tree.size();
+    // the nodes are laid out level by level with empty slots, so there are more of them than values
+    idx_header tree_size = nodes.size();
     fout.write((char *)&tree_size, sizeof(idx_header));
 
     for (int i = 0; i < tree_size; i++)
         fout.write((char *)&nodes[i], sizeof(epoch_data));
 
+    fout.write((char *)&tick_size, sizeof(double));
+    fout.write((char *)&keyframe_windows, sizeof(unsigned int));
     fout.close();
 }
 
@@ -103,12 +142,29 @@ void EpochIndexer::remove(uint64_t epoch)
 
 bool EpochIndexer::exists_higher(uint64_t epoch)
 {
-    return avl_tree.first_higher(avl_tree.root, epoch) < AVL_EMPTY_NODE;
+    return ceiling(epoch) != AVL_EMPTY_NODE;
 }
 
 bool EpochIndexer::exists_lower(uint64_t epoch)
 {
-    return avl_tree.first_lower(avl_tree.root, epoch) < AVL_EMPTY_NODE;
+    return floor(epoch) != AVL_EMPTY_NODE;
+}
+
+// Window start of the chunk covering the epoch, or of the last chunk before it
+uint64_t EpochIndexer::floor(uint64_t epoch)
+{
+    return avl_tree.floor(epoch);
+}
+
+uint64_t EpochIndexer::ceiling(uint64_t epoch)
+{
+    return avl_tree.ceiling(epoch);
+}
+
+// Window start of the first chunk strictly after the epoch
+uint64_t EpochIndexer::successor(uint64_t epoch)
+{
+    return avl_tree.successor(epoch);
 }
 
 bool EpochIndexer::empty() { return avl_tree.empty(); }
@@ -121,4 +177,42 @@ std::vector<uint64_t> EpochIndexer::epoch_list()
 std::vector<uint64_t> EpochIndexer::epoch_list_from(uint64_t epoch)
 {
     return avl_tree.serialize_inorder_from(epoch);
+}
+
+bool EpochIndexer::locate(uint64_t epoch, ChunkLocation &location)
+{
+    std::lock_guard<std::mutex> guard(location_mutex);
+
+    auto found = locations.find(epoch);
+    if (found == locations.end())
+        return false;
+
+    location = found->second;
+    return true;
+}
+
+void EpochIndexer::place(uint64_t epoch, const ChunkLocation &location)
+{
+    std::lock_guard<std::mutex> guard(location_mutex);
+    locations[epoch] = location;
+}
+
+void EpochIndexer::unplace(uint64_t epoch)
+{
+    std::lock_guard<std::mutex> guard(location_mutex);
+    locations.erase(epoch);
+}
+
+std::vector<SegmentEntry> EpochIndexer::segment_table(uint64_t segment)
+{
+    std::lock_guard<std::mutex> guard(location_mutex);
+
+    std::vector<SegmentEntry> table;
+    for (auto &entry : locations)
+        if (entry.second.segment == segment)
+            table.push_back({entry.first, entry.second});
+
+    std::sort(table.begin(), table.end(), [](const SegmentEntry &a, const SegmentEntry &b)
+              { return a.window < b.window; });
+    return table;
 }
\ No newline at end of file
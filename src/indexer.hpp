@@ -2,10 +2,12 @@
 #define EpochIndexer_HPP
 
 #include "avl_tree.hpp"
+#include "segment.hpp"
 #include <string>
 #include <thread>
 #include <vector>
 #include <mutex>
+#include <unordered_map>
 #include <unordered_set>
 #include <stdint.h>
 
@@ -23,26 +25,45 @@ class EpochIndexer
     
     std::unordered_set<uint64_t> epoch_set;
 
+    // chunks packed into segment files, which have no files of their own
+    std::mutex location_mutex;
+    std::unordered_map<uint64_t, ChunkLocation> locations;
+
     void read();
-    void flush();
+    void read_segments(const std::string &sub_dir);
 
 public:
     AVLTree<uint64_t> avl_tree;
+    double tick_size; // recorded with the index, so it stays fixed once the symbol has data
+    unsigned int keyframe_windows; // recorded the same way, as stored diffs depend on it
 
     typedef size_t idx_header;
     typedef uint64_t epoch_data;
     
-    EpochIndexer(std::string symbol, std::string data_dir, uint64_t epoch_window);
+    EpochIndexer(std::string symbol, std::string data_dir, uint64_t epoch_window, double tick_size, unsigned int keyframe_windows);
     ~EpochIndexer();
 
+    // writes the index out, which otherwise only happens on destruction
+    void flush();
+
     bool find(uint64_t epoch);
     void add(uint64_t epoch);
     void remove(uint64_t epoch);
     bool exists_higher(uint64_t epoch);
     bool exists_lower(uint64_t epoch);
+    uint64_t floor(uint64_t epoch);
+    uint64_t ceiling(uint64_t epoch);
+    uint64_t successor(uint64_t epoch);
     bool empty();
     std::vector<uint64_t> epoch_list();
     std::vector<uint64_t> epoch_list_from(uint64_t epoch);
+
+    // where the chunk of the window is packed, false if it is in files of its own
+    bool locate(uint64_t epoch, ChunkLocation &location);
+    void place(uint64_t epoch, const ChunkLocation &location);
+    void unplace(uint64_t epoch);
+    // offset table of a segment, from the chunks located in it
+    std::vector<SegmentEntry> segment_table(uint64_t segment);
 };
 
 #endif
\ No newline at end of file
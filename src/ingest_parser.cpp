@@ -0,0 +1,139 @@
+#include "ingest_parser.hpp"
+#include "include/p_insert.hpp"
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t LINE_FIELDS = 7;
+
+IngestParser::IngestParser(const std::string &source_file)
+{
+    int fd = ::open(source_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    length = file_stat.st_size;
+    if (length == 0)
+    {
+        ::close(fd);
+        is_valid = true;
+        return;
+    }
+
+    mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        return;
+    }
+
+    // the file is read once from start to end
+    madvise(mapping, length, MADV_SEQUENTIAL);
+
+    cursor = (const char *)mapping;
+    limit = cursor + length;
+    is_valid = true;
+}
+
+IngestParser::~IngestParser()
+{
+    if (mapping)
+        munmap(mapping, length);
+}
+
+bool IngestParser::next(IngestLine &line)
+{
+    while (cursor < limit)
+    {
+        // memchr is vectorised by the C library, so lines are found a word at a time
+        const char *line_end = (const char *)memchr(cursor, '\n', limit - cursor);
+        if (!line_end)
+            line_end = limit;
+
+        const char *line_start = cursor;
+        cursor = line_end < limit ? line_end + 1 : limit;
+
+        if (parse_line(line_start, line_end, line))
+            return true;
+
+        // blank lines (such as a trailing one) are not counted as malformed
+        if (line_end != line_start && !(line_end - line_start == 1 && *line_start == '\r'))
+            skipped_lines++;
+    }
+
+    return false;
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Splits a line into its 7 whitespace separated fields:
+// epoch | id | symbol | side | category | price | quantity
+bool IngestParser::parse_line(const char *begin, const char *end, IngestLine &line)
+{
+    std::string_view fields[LINE_FIELDS];
+    size_t count = 0;
+
+    const char *pos = begin;
+    while (pos < end)
+    {
+        while (pos < end && is_blank(*pos))
+            pos++;
+
+        if (pos == end)
+            break;
+
+        const char *field_start = pos;
+        while (pos < end && !is_blank(*pos))
+            pos++;
+
+        if (count == LINE_FIELDS)
+            return false;
+
+        fields[count++] = std::string_view(field_start, pos - field_start);
+    }
+
+    if (count != LINE_FIELDS)
+        return false;
+
+    auto parse_uint = [](std::string_view field, uint64_t &value)
+    {
+        std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), value);
+        return result.ec == std::errc() && result.ptr == field.data() + field.size();
+    };
+
+    std::from_chars_result price_result =
+        std::from_chars(fields[5].data(), fields[5].data() + fields[5].size(), line.price);
+    if (price_result.ec != std::errc() || price_result.ptr != fields[5].data() + fields[5].size())
+        return false;
+
+    DataOrder &order = line.order;
+    if (!parse_uint(fields[0], order.epoch) || !parse_uint(fields[1], order.id) || !parse_uint(fields[6], order.qty))
+        return false;
+
+    line.symbol = fields[2];
+    order.side = fields[3] == BUY_STR ? BUY : SELL;
+
+    if (fields[4] == CANCEL_STR)
+        order.category = CANCEL;
+    else if (fields[4] == TRADE_STR)
+        order.category = TRADE;
+    else
+        order.category = NEW;
+
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef IngestParser_HPP
+#define IngestParser_HPP
+
+#include "include/order.hpp"
+#include "include/price.hpp"
+#include <string>
+#include <string_view>
+#include <stddef.h>
+
+// One parsed line of an ingestion file. The symbol points into the parser's mapping, and the
+// price is left as read since its tick size depends on the symbol (order.price is not set)
+struct IngestLine
+{
+    std::string_view symbol;
+    DataOrder order;
+    double price;
+
+    // order with its price in ticks of the symbol's tick size
+    inline DataOrder ticked(double tick_size) const
+    {
+        DataOrder ticked_order = order;
+        ticked_order.price = to_ticks(price, tick_size);
+        return ticked_order;
+    }
+};
+
+// Reads an ingestion file line by line straight out of a read-only mapping.
+// Fields are split in place and numbers parsed with std::from_chars, so parsing a line
+// never allocates
+class IngestParser
+{
+    void *mapping = nullptr;
+    size_t length = 0;
+    bool is_valid = false;
+
+    const char *cursor = nullptr;
+    const char *limit = nullptr;
+    size_t skipped_lines = 0;
+
+    bool parse_line(const char *begin, const char *end, IngestLine &line);
+
+public:
+    IngestParser(const std::string &source_file);
+    ~IngestParser();
+
+    IngestParser(const IngestParser &) = delete;
+    IngestParser &operator=(const IngestParser &) = delete;
+
+    // false if the file couldn't be opened (an empty file is valid)
+    inline bool valid() const { return is_valid; }
+    inline size_t skipped() const { return skipped_lines; }
+
+    // Moves to the next line, false at the end of the file. Malformed lines are skipped,
+    // and the symbol stays valid until the parser is destroyed
+    bool next(IngestLine &line);
+};
+
+#endif
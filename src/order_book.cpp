@@ -1,102 +1,133 @@
 #include "include/order_book.hpp"
 #include <algorithm>
 
-void add_new(OrderBook *book, Order &order)
+std::vector<OrderEntry>::iterator PriceLevels::position(Price price)
 {
-    if (order.side == BUY)
-    {
-        if (book->buy_map.count(order.price))
-        {
-            OrderEntry old = book->buy_map[order.price];
-            old.qty += order.qty;
-            book->buy_map[order.price] = old;
-        }
-        else
-        {
-            book->buy_map[order.price] = OrderEntry(order.qty, order.price);
-        }
-    }
+    // most updates land at or right behind the touch, so the back is checked first
+    if (levels.empty() || worse(levels.back().price, price))
+        return levels.end();
+
+    if (levels.back().price == price)
+        return levels.end() - 1;
+
+    return std::lower_bound(levels.begin(), levels.end(), price,
+                            [this](const OrderEntry &entry, Price price)
+                            { return worse(entry.price, price); });
+}
+
+const OrderEntry *PriceLevels::find(Price price) const
+{
+    auto found = std::lower_bound(levels.begin(), levels.end(), price,
+                                  [this](const OrderEntry &entry, Price price)
+                                  { return worse(entry.price, price); });
+
+    if (found == levels.end() || found->price != price)
+        return nullptr;
+
+    return &(*found);
+}
+
+void PriceLevels::add(uint64_t qty, Price price)
+{
+    auto found = position(price);
+
+    if (found != levels.end() && found->price == price)
+        found->qty += qty;
     else
-    {
-        if (book->sell_map.count(order.price))
-        {
-            OrderEntry old = book->sell_map[order.price];
-            old.qty += order.qty;
-            book->sell_map[order.price] = old;
-        }
-        else
-        {
-            book->sell_map[order.price] = OrderEntry(order.qty, order.price);
-        }
-    }
+        levels.insert(found, OrderEntry(qty, price));
 }
 
-void remove_qty(OrderBook *book, Order &order)
+void PriceLevels::remove(uint64_t qty, Price price)
 {
-    OrderEntry old;
+    auto found = position(price);
 
-    if (order.side == BUY && book->buy_map.count(order.price))
-    {
-        OrderEntry old = book->buy_map[order.price];
+    if (found == levels.end() || found->price != price)
+        return;
+
+    if (qty >= found->qty)
+        levels.erase(found);
+    else
+        found->qty -= qty;
+}
 
-        if (order.qty >= old.qty)
-        {
-            book->buy_map.erase(order.price);
-            return;
-        }
+void PriceLevels::set(uint64_t qty, Price price)
+{
+    auto found = position(price);
+    bool is_found = found != levels.end() && found->price == price;
 
-        old.qty -= order.qty;
-        book->buy_map[order.price] = old;
-    }
-    else if (book->sell_map.count(order.price))
+    if (!qty)
     {
-        OrderEntry old = book->sell_map[order.price];
+        if (is_found)
+            levels.erase(found);
+    }
+    else if (is_found)
+        found->qty = qty;
+    else
+        levels.insert(found, OrderEntry(qty, price));
+}
+
+// Replaces the levels with stored ones, which are already sorted unless written by an older version
+void PriceLevels::assign(const OrderEntry *begin, const OrderEntry *end)
+{
+    levels.assign(begin, end);
 
-        if (order.qty >= old.qty)
-        {
-            book->sell_map.erase(order.price);
-            return;
-        }
+    auto order = [this](const OrderEntry &a, const OrderEntry &b)
+    { return worse(a.price, b.price); };
 
-        old.qty -= order.qty;
-        book->sell_map[order.price] = old;
-    }
+    if (!std::is_sorted(levels.begin(), levels.end(), order))
+        std::sort(levels.begin(), levels.end(), order);
+}
+
+// The best depth levels, best price first
+std::vector<OrderEntry> PriceLevels::top(size_t depth) const
+{
+    size_t count = depth ? std::min(depth, levels.size()) : levels.size();
+    return std::vector<OrderEntry>(levels.rbegin(), levels.rbegin() + count);
 }
 
 void OrderBook::add(Order &order)
 {
+    PriceLevels &levels = order.side == BUY ? buy_levels : sell_levels;
+
     if (order.category == NEW)
     {
-        add_new(this, order);
+        levels.add(order.qty, order.price);
     }
     else if (order.category == CANCEL)
     {
-        remove_qty(this, order);
+        levels.remove(order.qty, order.price);
     }
     else if (order.category == TRADE)
     {
-        remove_qty(this, order);
+        levels.remove(order.qty, order.price);
     }
 }
 
-bool OrderBook::empty() { return buy_map.empty() && sell_map.empty(); }
+bool OrderBook::empty() { return buy_levels.empty() && sell_levels.empty(); }
 
-std::vector<OrderEntry> OrderBook::buy_list()
-{
-    std::vector<OrderEntry> buy_vect;
+std::vector<OrderEntry> OrderBook::buy_list() { return buy_levels.top(0); }
 
-    for (auto &entry_pair : buy_map)
-        buy_vect.push_back(entry_pair.second);
+std::vector<OrderEntry> OrderBook::sell_list() { return sell_levels.top(0); }
 
-    return buy_vect;
+const OrderEntry *OrderBook::best_bid() const
+{
+    return buy_levels.empty() ? nullptr : &buy_levels.best();
 }
 
-std::vector<OrderEntry> OrderBook::sell_list()
+const OrderEntry *OrderBook::best_ask() const
 {
-    std::vector<OrderEntry> sell_vect;
+    return sell_levels.empty() ? nullptr : &sell_levels.best();
+}
 
-    for (auto &entry_pair : sell_map)
-        sell_vect.push_back(entry_pair.second);
+OrderBook OrderBook::top(size_t depth) const
+{
+    if (!depth)
+        return *this;
 
-    return sell_vect;
-}
\ No newline at end of file
+    OrderBook book;
+    const std::vector<OrderEntry> &buys = buy_levels.entries();
+    const std::vector<OrderEntry> &sells = sell_levels.entries();
+    book.buy_levels.assign(buys.data() + buys.size() - std::min(depth, buys.size()), buys.data() + buys.size());
+    book.sell_levels.assign(sells.data() + sells.size() - std::min(depth, sells.size()), sells.data() + sells.size());
+    return book;
+}
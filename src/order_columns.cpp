@@ -0,0 +1,206 @@
+#include "order_columns.hpp"
+#include <cstring>
+
+#ifdef OW_HAS_AVX2
+#include <immintrin.h>
+#endif
+
+// Orders left to the count once the binary search has narrowed the range down this far
+static const size_t SCAN_ORDERS = 64;
+
+OrderColumns map_columns(const char *data, size_t count)
+{
+    OrderColumns columns;
+    columns.epochs = (const uint64_t *)data;
+    columns.ids = columns.epochs + count;
+    columns.prices = (const Price *)(columns.ids + count);
+    columns.qtys = (const uint64_t *)(columns.prices + count);
+    columns.kinds = (const uint8_t *)(columns.qtys + count);
+    columns.count = count;
+    return columns;
+}
+
+void store_columns(char *data, const DataOrder *orders, size_t count)
+{
+    OrderColumns columns = map_columns(data, count);
+    uint64_t *epochs = (uint64_t *)columns.epochs;
+    uint64_t *ids = (uint64_t *)columns.ids;
+    Price *prices = (Price *)columns.prices;
+    uint64_t *qtys = (uint64_t *)columns.qtys;
+    uint8_t *kinds = (uint8_t *)columns.kinds;
+
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const DataOrder &order = orders[idx];
+        epochs[idx] = order.epoch;
+        ids[idx] = order.id;
+        prices[idx] = order.price;
+        qtys[idx] = order.qty;
+        kinds[idx] = order_kind(order.side, order.category);
+    }
+}
+
+void load_columns(const OrderColumns &columns, DataOrder *orders)
+{
+    for (size_t idx = 0; idx < columns.count; idx++)
+    {
+        DataOrder &order = orders[idx];
+        order.epoch = columns.epochs[idx];
+        order.id = columns.ids[idx];
+        order.price = columns.prices[idx];
+        order.qty = columns.qtys[idx];
+        order.side = (Side)(columns.kinds[idx] & 1);
+        order.category = (Category)((columns.kinds[idx] >> 1) & 3);
+    }
+}
+
+static inline bool is_trade(uint8_t kind)
+{
+    return ((kind >> 1) & 3) == TRADE;
+}
+
+static size_t count_below_scalar(const uint64_t *epochs, size_t count, uint64_t epoch)
+{
+    size_t below = 0;
+    for (size_t idx = 0; idx < count; idx++)
+        below += epochs[idx] < epoch;
+
+    return below;
+}
+
+#ifdef OW_HAS_AVX2
+static bool has_avx2()
+{
+    static const bool is_supported = __builtin_cpu_supports("avx2");
+    return is_supported;
+}
+
+// AVX2 only compares signed lanes, so both sides have their sign bit flipped first
+__attribute__((target("avx2"))) static size_t count_below_avx2(const uint64_t *epochs, size_t count, uint64_t epoch)
+{
+    const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((long long)epoch), bias);
+
+    size_t below = 0;
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4)
+    {
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(epochs + idx)), bias);
+        __m256i is_below = _mm256_cmpgt_epi64(key, values);
+        below += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(is_below)));
+    }
+
+    return below + count_below_scalar(epochs + idx, count - idx, epoch);
+}
+
+__attribute__((target("avx2"))) static uint64_t traded_qty_avx2(const uint64_t *qtys, const uint8_t *kinds, size_t count)
+{
+    const __m256i category = _mm256_set1_epi64x(3 << 1);
+    const __m256i trade = _mm256_set1_epi64x(TRADE << 1);
+    __m256i sums = _mm256_setzero_si256();
+
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4)
+    {
+        int packed;
+        memcpy(&packed, kinds + idx, sizeof(int));
+        __m256i kind = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+        __m256i is_trade = _mm256_cmpeq_epi64(_mm256_and_si256(kind, category), trade);
+        __m256i qty = _mm256_loadu_si256((const __m256i *)(qtys + idx));
+        sums = _mm256_add_epi64(sums, _mm256_and_si256(is_trade, qty));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + traded_qty_scalar(qtys + idx, kinds + idx, count - idx);
+}
+#endif
+
+static size_t count_below(const uint64_t *epochs, size_t count, uint64_t epoch)
+{
+#ifdef OW_HAS_AVX2
+    if (has_avx2())
+        return count_below_avx2(epochs, count, epoch);
+#endif
+    return count_below_scalar(epochs, count, epoch);
+}
+
+// Binary search down to at most SCAN_ORDERS epochs, returning the first of them
+static size_t narrow_range(const uint64_t *epochs, size_t &count, uint64_t epoch)
+{
+    size_t first = 0;
+    while (count > SCAN_ORDERS)
+    {
+        size_t half = count / 2;
+        if (epochs[first + half] < epoch)
+        {
+            first += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+
+    return first;
+}
+
+size_t epoch_lower_bound(const uint64_t *epochs, size_t count, uint64_t epoch)
+{
+    size_t first = narrow_range(epochs, count, epoch);
+    return first + count_below(epochs + first, count, epoch);
+}
+
+size_t epoch_lower_bound(const DataOrder *orders, size_t count, uint64_t epoch)
+{
+    size_t first = 0;
+    while (count > 0)
+    {
+        size_t half = count / 2;
+        if (orders[first + half].epoch < epoch)
+        {
+            first += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+
+    return first;
+}
+
+size_t epoch_lower_bound_scalar(const uint64_t *epochs, size_t count, uint64_t epoch)
+{
+    size_t first = narrow_range(epochs, count, epoch);
+    return first + count_below_scalar(epochs + first, count, epoch);
+}
+
+uint64_t traded_qty(const OrderColumns &columns, size_t first, size_t last)
+{
+    if (first >= last)
+        return 0;
+
+#ifdef OW_HAS_AVX2
+    if (has_avx2())
+        return traded_qty_avx2(columns.qtys + first, columns.kinds + first, last - first);
+#endif
+    return traded_qty_scalar(columns.qtys + first, columns.kinds + first, last - first);
+}
+
+uint64_t traded_qty(const DataOrder *orders, size_t count)
+{
+    // masked rather than branched on, as trades and other orders come mixed together
+    uint64_t total = 0;
+    for (size_t idx = 0; idx < count; idx++)
+        total += orders[idx].qty & -(uint64_t)(orders[idx].category == TRADE);
+
+    return total;
+}
+
+uint64_t traded_qty_scalar(const uint64_t *qtys, const uint8_t *kinds, size_t count)
+{
+    uint64_t total = 0;
+    for (size_t idx = 0; idx < count; idx++)
+        total += qtys[idx] & -(uint64_t)is_trade(kinds[idx]);
+
+    return total;
+}
@@ -0,0 +1,56 @@
+#ifndef OrderColumns_HPP
+#define OrderColumns_HPP
+
+#include "include/order.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define OW_HAS_AVX2 1
+#endif
+
+// Bytes a single order takes in the columns: its epoch, id, price and qty, then a byte for its kind
+static const size_t ORDER_COLUMN_BYTES = 3 * sizeof(uint64_t) + sizeof(Price) + sizeof(uint8_t);
+
+// Orders stored one field after the other, so a scan over a field only reads that field. The
+// kind of an order packs its side into the low bit and its category into the two bits above.
+// Columns are laid out as epochs, ids, prices, qtys then kinds, each count long
+struct OrderColumns
+{
+    const uint64_t *epochs = nullptr;
+    const uint64_t *ids = nullptr;
+    const Price *prices = nullptr;
+    const uint64_t *qtys = nullptr;
+    const uint8_t *kinds = nullptr;
+    size_t count = 0;
+};
+
+inline uint8_t order_kind(Side side, Category category)
+{
+    return (side & 1) | (category & 3) << 1;
+}
+
+// Columns of count orders starting at data, which has to be 8 byte aligned
+OrderColumns map_columns(const char *data, size_t count);
+
+// Writes the orders as columns into the ORDER_COLUMN_BYTES * count bytes at data (8 byte aligned)
+void store_columns(char *data, const DataOrder *orders, size_t count);
+
+// Copies the orders in the columns out as records
+void load_columns(const OrderColumns &columns, DataOrder *orders);
+
+// Index of the first order at or after the epoch (count if there is none), for orders sorted by
+// epoch. A binary search narrows the range down, and the orders left are counted with AVX2
+// wherever the CPU has it. The record version reads the same, over whole records
+size_t epoch_lower_bound(const uint64_t *epochs, size_t count, uint64_t epoch);
+size_t epoch_lower_bound(const DataOrder *orders, size_t count, uint64_t epoch);
+
+// Total qty of the trades among orders [first, last)
+uint64_t traded_qty(const OrderColumns &columns, size_t first, size_t last);
+uint64_t traded_qty(const DataOrder *orders, size_t count);
+
+// Scalar kernels the vector ones fall back to, kept apart to compare them against
+size_t epoch_lower_bound_scalar(const uint64_t *epochs, size_t count, uint64_t epoch);
+uint64_t traded_qty_scalar(const uint64_t *qtys, const uint8_t *kinds, size_t count);
+
+#endif
@@ -0,0 +1,229 @@
+#include "order_log.hpp"
+#include <algorithm>
+#include <cstring>
+
+// The first byte of an encoded order holds its side and category in the low bits, then flags for
+// the fields that are left out as they follow on from the order before it
+static const uint8_t SEQUENTIAL_ID = 1 << 3; // the previous id plus 1
+static const uint8_t SAME_PRICE = 1 << 4;
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline void put_varint(std::vector<char> &buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((char)value);
+}
+
+static inline bool get_varint(const char *&cursor, const char *limit, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && cursor < limit; shift += 7)
+    {
+        uint8_t byte = *cursor++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// Order the first one of a block is encoded against, as blocks don't depend on each other
+static inline DataOrder block_start(const OrderBlock &block)
+{
+    DataOrder start;
+    start.epoch = block.first_epoch;
+    start.id = 0;
+    start.side = SELL;
+    start.category = TRADE;
+    start.qty = 0;
+    start.price = 0;
+    return start;
+}
+
+static void encode_order(std::vector<char> &buffer, const DataOrder &order, const DataOrder &previous)
+{
+    uint8_t tag = (order.side & 1) | (order.category & 3) << 1;
+    if (order.id == previous.id + 1)
+        tag |= SEQUENTIAL_ID;
+    if (order.price == previous.price)
+        tag |= SAME_PRICE;
+
+    buffer.push_back((char)tag);
+    put_varint(buffer, zigzag((int64_t)(order.epoch - previous.epoch)));
+    if (!(tag & SEQUENTIAL_ID))
+        put_varint(buffer, zigzag((int64_t)(order.id - previous.id)));
+    put_varint(buffer, order.qty);
+    if (!(tag & SAME_PRICE))
+        put_varint(buffer, zigzag(order.price - previous.price));
+}
+
+// Decodes the order at the cursor into the order before it
+static bool decode_order(const char *&cursor, const char *limit, DataOrder &order)
+{
+    if (cursor >= limit)
+        return false;
+
+    uint8_t tag = *cursor++;
+    uint64_t value;
+    if (!get_varint(cursor, limit, value))
+        return false;
+    order.epoch += unzigzag(value);
+
+    if (tag & SEQUENTIAL_ID)
+        order.id++;
+    else if (get_varint(cursor, limit, value))
+        order.id += unzigzag(value);
+    else
+        return false;
+
+    if (!get_varint(cursor, limit, order.qty))
+        return false;
+
+    if (!(tag & SAME_PRICE))
+    {
+        if (!get_varint(cursor, limit, value))
+            return false;
+        order.price += unzigzag(value);
+    }
+
+    order.side = (Side)(tag & 1);
+    order.category = (Category)((tag >> 1) & 3);
+    return true;
+}
+
+void encode_order_log(std::vector<char> &buffer, const DataOrder *orders, size_t count)
+{
+    OrderLogTail tail;
+    extend_order_log(tail, orders, count, buffer);
+}
+
+bool decode_order_log(const char *log, size_t length, size_t count, std::vector<DataOrder> &orders)
+{
+    orders.resize(count);
+
+    size_t decoded = 0;
+    const char *cursor = log;
+    const char *limit = log + length;
+    while (decoded < count && (size_t)(limit - cursor) >= sizeof(OrderBlock))
+    {
+        OrderBlock block;
+        memcpy(&block, cursor, sizeof(OrderBlock));
+        cursor += sizeof(OrderBlock);
+
+        // the last block may claim orders an interrupted append never finished
+        const char *block_end = block.bytes < (size_t)(limit - cursor) ? cursor + block.bytes : limit;
+        size_t block_end_count = decoded + std::min((size_t)block.count, count - decoded);
+        if (block.count == 0)
+            break;
+
+        DataOrder order = block_start(block);
+        while (decoded < block_end_count && decode_order(cursor, block_end, order))
+            orders[decoded++] = order;
+        if (decoded < block_end_count)
+            break;
+
+        cursor = block_end;
+    }
+
+    // a damaged log gives back the orders before the damage
+    orders.resize(decoded);
+    return decoded == count;
+}
+
+bool find_log_tail(const char *log, size_t length, size_t count, OrderLogTail &tail)
+{
+    tail = OrderLogTail();
+
+    size_t offset = 0;
+    size_t remaining = count;
+    while (remaining > 0)
+    {
+        OrderBlock block;
+        if (length - offset < sizeof(OrderBlock))
+            return false;
+        memcpy(&block, log + offset, sizeof(OrderBlock));
+        if (block.count == 0)
+            return false;
+        if (offset == 0)
+            tail.first_epoch = block.first_epoch;
+
+        size_t body = length - offset - sizeof(OrderBlock);
+        if (remaining > block.count)
+        {
+            if (block.bytes > body)
+                return false;
+
+            offset += sizeof(OrderBlock) + block.bytes;
+            remaining -= block.count;
+            continue;
+        }
+
+        // only the orders the log holds are counted, whatever the block's header says
+        const char *start = log + offset + sizeof(OrderBlock);
+        const char *cursor = start;
+        DataOrder order = block_start(block);
+        for (size_t idx = 0; idx < remaining; idx++)
+            if (!decode_order(cursor, start + body, order))
+                return false;
+
+        block.count = remaining;
+        block.bytes = cursor - start;
+        block.last_epoch = order.epoch;
+        tail.block_offset = offset;
+        tail.block = block;
+        tail.last = order;
+        return true;
+    }
+
+    return true;
+}
+
+void extend_order_log(OrderLogTail &tail, const DataOrder *orders, size_t count, std::vector<char> &buffer)
+{
+    // block the orders go into, and its offset in the buffer (SIZE_MAX for the tail's own block)
+    OrderBlock block = tail.block;
+    size_t block_at = SIZE_MAX;
+    auto store_block = [&]()
+    {
+        if (block_at == SIZE_MAX)
+            tail.block = block;
+        else
+            memcpy(buffer.data() + block_at, &block, sizeof(OrderBlock));
+    };
+
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const DataOrder &order = orders[idx];
+        if (block.count == 0 || block.count == LOG_BLOCK_ORDERS)
+        {
+            store_block();
+            block = {0, 0, order.epoch, order.epoch};
+            block_at = buffer.size();
+            buffer.resize(buffer.size() + sizeof(OrderBlock));
+            tail.last = block_start(block);
+        }
+
+        size_t start = buffer.size();
+        encode_order(buffer, order, tail.last);
+        block.count++;
+        block.bytes += buffer.size() - start;
+        block.last_epoch = order.epoch;
+        tail.last = order;
+    }
+
+    store_block();
+}
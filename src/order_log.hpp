@@ -0,0 +1,50 @@
+#ifndef OrderLog_HPP
+#define OrderLog_HPP
+
+#include "include/order.hpp"
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Orders per block of an encoded order log
+static const uint32_t LOG_BLOCK_ORDERS = 128;
+
+// Header in front of every block of an encoded order log. The orders of a block are encoded
+// against its first epoch only, so each block decodes on its own and readers can step over whole
+// blocks by their length without decoding them
+struct OrderBlock
+{
+    uint32_t count;
+    uint32_t bytes; // encoded orders after this header
+    uint64_t first_epoch;
+    uint64_t last_epoch;
+};
+
+// Last block of an encoded log and the last order in it, which appended orders are encoded after
+struct OrderLogTail
+{
+    size_t block_offset = 0; // from the start of the log
+    OrderBlock block = {0, 0, 0, 0}; // a count of 0 for a log without any block
+    DataOrder last;
+    uint64_t first_epoch = 0; // of the log's first block
+};
+
+// Appends the orders to the buffer as an encoded log. Each order takes one byte for its side,
+// category and whether its id and price follow on from the order before it, then varints for its
+// epoch delta, id delta, qty and price delta in ticks (the deltas zig-zag encoded)
+void encode_order_log(std::vector<char> &buffer, const DataOrder *orders, size_t count);
+
+// Decodes the first count orders of a log of the given length. False if it is shorter or damaged
+bool decode_order_log(const char *log, size_t length, size_t count, std::vector<DataOrder> &orders);
+
+// Steps over the blocks of a log holding count orders, and only decodes the block the last of them
+// is in. Blocks are followed by their counts, which may run past the orders of a log that was cut
+// off in the middle of an append. False if the log is damaged
+bool find_log_tail(const char *log, size_t length, size_t count, OrderLogTail &tail);
+
+// Encodes orders following on from the tail into the buffer, which goes at the end of the log.
+// The tail's block is filled up before new blocks are started in the buffer, so its header in the
+// tail changes too and has to be written again at its offset (unless its count stays 0)
+void extend_order_log(OrderLogTail &tail, const DataOrder *orders, size_t count, std::vector<char> &buffer);
+
+#endif
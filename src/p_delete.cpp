@@ -3,6 +3,8 @@
 #include "include/order_book.hpp"
 #include "header.hpp"
 #include "shared.hpp"
+#include "symbol_ingest.hpp"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <stdint.h>
@@ -14,7 +16,15 @@ PDelete::PDelete(Config *conf) : conf(conf) {}
 
 bool PDelete::delete_order(std::string symbol, uint64_t id, uint64_t epoch)
 {
-    std::lock_guard<std::mutex> lock(conf->locks[symbol]);
+    std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+    if (conf->memtable_orders)
+    {
+        MemTable &table = conf->buffer.table(symbol);
+        bool success = table.remove(conf, id, epoch);
+        conf->buffer.written(table);
+        return success;
+    }
+
     EpochIndexer *idx = conf->get_or_create_index(symbol);
 
     if (!idx->find(generate_epoch_window(conf, epoch)))
@@ -23,74 +33,60 @@ bool PDelete::delete_order(std::string symbol, uint64_t id, uint64_t epoch)
     std::pair<std::string, uint64_t> filename =
         generate_filename(conf, epoch, symbol);
 
-    std::string old_name = filename.first;
-    remove_string_end(4, old_name);
-    old_name.append(OLD);
-    fs::rename(filename.first, old_name);
+    Header header;
+    OrderBook book;
+    std::vector<DataOrder> orders;
+    read_chunk(conf, symbol, filename.second, header, book, orders);
 
-    std::ifstream fin(old_name, std::ios::in | std::ios::binary);
-    std::ofstream fout(filename.first, std::ios::out | std::ios::binary);
+    auto found = std::find_if(orders.begin(), orders.end(), [&](const DataOrder &stored_order)
+                              { return stored_order.id == id && stored_order.epoch == epoch; });
 
-    Header header;
-    fin.read((char *)&header, sizeof(Header));
-    header.update_size--;
+    // cannot find order
+    if (found == orders.end())
+        return false;
 
-    OrderBook book;
-    for (int i = 0; i < header.base_buy; i++)
-    {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.buy_map[entry.price] = entry;
-    }
+    DataOrder found_order = *found;
+    orders.erase(found);
 
-    for (int i = 0; i < header.base_sell; i++)
-    {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.sell_map[entry.price] = entry;
-    }
+    if (!orders.empty())
+        write_chunk(conf, symbol, filename.second, header, book, orders);
 
-    if (header.update_size > 0)
-    {
-        write_header(fout, header);
-        write_base_book(fout, book);
-    }
+    Order reversed = reverse_polarity(found_order, symbol);
+    reconfig_ahead(conf, reversed.epoch, reversed.symbol, reversed);
 
-    unsigned int j = 0;
-    DataOrder found_order;
-    bool is_found = false;
-    while (j < header.update_size + 1)
+    if (orders.empty())
     {
-        DataOrder stored_order;
-        fin.read((char *)&stored_order, sizeof(DataOrder));
-
-        // skip this
-        if (!is_found && stored_order.id == id && stored_order.epoch == epoch)
-        {
-            found_order = stored_order;
-            j++;
-            is_found = true;
-            continue;
-        }
+        remove_chunk(conf, symbol, filename.second);
+        idx->remove(filename.second);
+    }
 
-        // cannot find order
-        if (!is_found && stored_order.epoch > epoch)
-            return false;
+    return true;
+}
 
-        j++;
-        if (header.update_size > 0)
-            fout.write((char *)&stored_order, sizeof(DataOrder));
-    }
+// Deletions are handed to a backfill pass as edits, which nets the reversed orders of all of
+// them into one shift of the later base states
+size_t PDelete::delete_orders(std::string symbol, std::vector<std::pair<uint64_t, uint64_t>> orders)
+{
+    std::stable_sort(orders.begin(), orders.end(), [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b)
+                     { return a.second < b.second; });
 
-    fout.close();
-    fin.close();
-    fs::remove(old_name);
+    std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+    if (conf->memtable_orders)
+        conf->buffer.flush(symbol);
 
-    Order reversed = reverse_polarity(found_order, symbol);
-    reconfig_ahead(conf, reversed.epoch, reversed.symbol, reversed);
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    SymbolBackfill backfill(conf, symbol);
+    for (std::pair<uint64_t, uint64_t> &order : orders)
+    {
+        if (!idx->find(generate_epoch_window(conf, order.second)))
+            continue;
 
-    if (header.update_size == 0)
-        fs::remove(filename.first);
+        DataOrder stored;
+        stored.id = order.first;
+        stored.epoch = order.second;
+        backfill.edit(ChunkEdit{stored, stored, true});
+    }
 
-    return true;
-}
\ No newline at end of file
+    backfill.finish();
+    return backfill.edited;
+}
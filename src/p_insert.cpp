@@ -6,357 +6,570 @@
 #include "shared.hpp"
 #include "header.hpp"
 #include "indexer.hpp"
+#include "ingest_parser.hpp"
+#include "symbol_ingest.hpp"
+#include "spsc_ring.hpp"
+#include "chunk_writer.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
-#include <fstream>
 #include <functional>
-#include <iterator>
+#include <memory>
+#include <mutex>
 #include <set>
-#include <sstream>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+
+// Orders handed from the parse stage to the apply stage at once, and batches or chunks in flight
+static const size_t INGEST_BATCH = 4096;
+static const size_t PARSED_QUEUE = 16;
+static const size_t CHUNK_QUEUE = 4;
+
+// Rows handed to a market ingestion worker at once, and batches queued per worker
+static const size_t MARKET_BATCH = 4096;
+static const size_t MARKET_QUEUE = 8;
+// Longest a market ingestion worker keeps a symbol locked before writing out its rows so far
+static const std::chrono::milliseconds MARKET_LOCK_HOLD(100);
 
 PInsert::PInsert(Config *conf) : conf(conf) {}
 
-void edit_header(std::string &filename, Header &header)
+bool create_new_file_order(Config *conf, EpochIndexer *indexer, uint64_t window_start, Order &order)
 {
-    std::fstream fstr(filename, std::ios::binary | std::ios::out | std::ios::in);
-    fstr.write((char *)&header, sizeof(Header));
-    fstr.close();
-}
+    // If category is not NEW for an initial order,
+    // it cannot be processed, as there is nothing to trade or cancel
+    if (order.category != NEW)
+        return false;
 
-void write_order(std::ofstream &fout, Order &order)
-{
-    DataOrder data_order = DataOrder(order);
-    fout.write((char *)&data_order, sizeof(DataOrder));
+    Header header(0, 0, 1, 0, 0, 0);
+    OrderBook book;
+    std::vector<DataOrder> orders = {DataOrder(order)};
+    write_chunk(conf, order.symbol, window_start, header, book, orders);
+
+    indexer->add(window_start);
+
+    return true;
 }
 
-Order convert_line_order(std::string file_line)
+bool create_file_existing_symbol(Config *conf, uint64_t window_start, Order &order)
 {
-    std::stringstream stream(file_line);
-    std::istream_iterator<std::string> begin(stream);
-    std::istream_iterator<std::string> end;
-    std::vector<std::string> fields(begin, end);
-
-    Side side = fields[3] == BUY_STR ? BUY : SELL;
-
-    Category cat;
-    if (fields[4] == CANCEL_STR)
-        cat = CANCEL;
-    else if (fields[4] == TRADE_STR)
-        cat = TRADE;
-    else
-        cat = NEW;
+    PQuery processor(conf);
+    QueryResult query = processor.query_stored(order.epoch, order.symbol);
 
-    Order order(fields[2],
-                std::stoull(fields[0]),
-                std::stoull(fields[1]),
-                side,
-                cat,
-                std::stoull(fields[6]),
-                atof(fields[5].c_str()));
+    unsigned long buy_size = query.book.buy_levels.size();
+    unsigned long sell_size = query.book.sell_levels.size();
+    Header header(buy_size, sell_size, 1, query.last_trade_qty, query.last_trade_price, query.last_trade_epoch);
 
-    return order;
+    std::vector<DataOrder> orders = {DataOrder(order)};
+    write_chunk(conf, order.symbol, window_start, header, query.book, orders);
+
+    conf->get_or_create_index(order.symbol)->add(window_start);
+
+    return true;
 }
 
-bool optimized_file_ingestion(Config *conf,
-                              std::string source_file,
-                              std::string symbol,
-                              OrderBook &order_book,
-                              Header &header)
+bool add_order_to_file(Config *conf, uint64_t window_start, Order &order)
 {
-    std::ifstream source(source_file);
+    Header header;
+    OrderBook book;
+    std::vector<DataOrder> orders;
+    read_chunk(conf, order.symbol, window_start, header, book, orders);
 
-    std::string file_line = "";
-    uint64_t chunk_curr_epoch = 0;
-    std::string chunk_curr_name = "";
-    std::ofstream fout;
+    // the order goes after every stored order of the same or an earlier epoch
+    auto position = std::upper_bound(orders.begin(), orders.end(), order.epoch,
+                                     [](uint64_t epoch, const DataOrder &stored_order)
+                                     { return epoch < stored_order.epoch; });
+    orders.insert(position, DataOrder(order));
 
-    unsigned long last_trade_qty = header.last_trade_qty;
-    unsigned long last_trade_price = header.last_trade_price;
-    uint64_t last_trade_epoch = header.last_trade_epoch;
+    write_chunk(conf, order.symbol, window_start, header, book, orders);
 
-    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    reconfig_ahead(conf, order.epoch, order.symbol, order);
+    return true;
+}
 
-    bool first = true;
-    while (std::getline(source, file_line))
-    {
-        Order line_order = convert_line_order(file_line);
-        std::pair<std::string, uint64_t> chunk =
-            generate_filename(conf, line_order.epoch, symbol);
+// Appends an order to the latest chunk in place: the record goes right after the stored orders
+// (or into the last block of an encoded log), then the header is rewritten with the new order
+// count, instead of rewriting the whole chunk.
+// A checkpoint that is due only rewrites the base file. False if the chunk has to be rewritten
+// instead, which is when the order is earlier than the chunk's last order, the chunk is still
+// in an old format, or its orders are stored as columns that every order would have to move
+bool append_order_to_tail(Config *conf, uint64_t window_start, Order &order)
+{
+    std::string filename = generate_filename(conf, window_start, order.symbol).first;
+    if (!conf->segments.unpack(order.symbol, window_start))
+        return false;
 
-        if (chunk.second != chunk_curr_epoch)
-        {
-            fout.close();
+    std::shared_ptr<ChunkReader> reader = conf->chunks.open(filename, conf->tick_size(order.symbol));
+    if (!reader->valid() || reader->header().version != CHUNK_VERSION)
+        return false;
 
-            uint64_t window_start = generate_epoch_window(conf, line_order.epoch);
-            idx->add(window_start);
+    // a chunk without orders takes the configured layout
+    Header header = reader->header();
+    OrderLayout layout = header.update_size == 0 ? conf->order_layout : header.order_layout;
+    if (layout == ORDER_COLUMNS)
+        return false;
 
-            if (!first)
-                edit_header(chunk_curr_name, header);
-            else
-                first = false;
+    // an encoded log is only read from its first and last blocks
+    Span<DataOrder> orders = reader->orders();
+    Span<char> log = reader->encoded_orders();
+    OrderLogTail tail;
+    if (header.order_layout == ORDER_LOG && !find_log_tail(log.begin(), log.size(), header.update_size, tail))
+        return false;
 
-            fout = std::ofstream(chunk.first, std::ios::out | std::ios::binary);
+    bool is_encoded = layout == ORDER_LOG;
+    uint64_t first_epoch = header.update_size == 0 ? order.epoch : is_encoded ? tail.first_epoch : orders[0].epoch;
+    uint64_t back_epoch = header.update_size == 0 ? order.epoch : is_encoded ? tail.last.epoch : orders.back().epoch;
+    if (order.epoch < back_epoch)
+        return false;
+
+    Span<Checkpoint> checkpoints = reader->checkpoints();
+    unsigned long last_count = checkpoints.empty() ? 0 : checkpoints.back().order_count;
+    uint64_t last_epoch = checkpoints.empty() ? first_epoch : checkpoints.back().epoch;
+    bool is_checkpoint_due = checkpoint_due(conf, header.update_size + 1 - last_count, order.epoch - last_epoch);
 
-            // adding header
-            header.base_buy = order_book.buy_map.size();
-            header.base_sell = order_book.sell_map.size();
-            header.update_size = 0;
-            header.last_trade_qty = last_trade_qty;
-            header.last_trade_price = last_trade_price;
-            header.last_trade_epoch = last_trade_epoch;
-            write_header(fout, header);
+    header.update_size++;
+    header.order_layout = layout;
+    DataOrder appended(order);
+    if (is_encoded)
+    {
+        static thread_local std::vector<char> encoded;
+        encoded.clear();
+        extend_order_log(tail, &appended, 1, encoded);
+        header.order_bytes += encoded.size();
+        if (!append_chunk_log(filename, reader->data_length(), encoded, sizeof(Header) + tail.block_offset, tail.block, header))
+            return false;
+    }
+    else if (!append_chunk_orders(filename, reader->data_length(), &appended, 1, header))
+        return false;
 
-            // adding base
-            write_base_book(fout, order_book);
+    conf->chunks.invalidate(filename);
 
-            chunk_curr_epoch = chunk.second;
-            chunk_curr_name = chunk.first;
-            first = false;
-        }
+    std::shared_ptr<const DecodedChunk> cached = conf->decoded.peek(order.symbol, window_start);
+    if (cached)
+    {
+        // the cached copy may have logged changes folded into its base state, which the file lacks
+        std::shared_ptr<DecodedChunk> chunk = std::make_shared<DecodedChunk>(*cached);
+        chunk->header.update_size = header.update_size;
+        chunk->header.order_bytes = header.order_bytes;
+        chunk->header.order_layout = layout;
+        chunk->orders.push_back(appended);
+        conf->decoded.patch(order.symbol, window_start, chunk);
+    }
 
-        if (line_order.category == TRADE)
+    // the chunk already reads right without the checkpoint, so a failed base write costs nothing
+    if (is_checkpoint_due)
+    {
+        Header base_header;
+        OrderBook base;
+        std::vector<DataOrder> chunk_orders;
+        CheckpointTable table;
+        if (read_chunk(conf, order.symbol, window_start, base_header, base, chunk_orders))
         {
-            last_trade_qty = line_order.qty;
-            last_trade_price = line_order.price;
-            last_trade_epoch = line_order.epoch;
+            build_checkpoints(conf, base_header, base, chunk_orders, table);
+            write_chunk_base(conf, order.symbol, window_start, base_header, base, table, chunk_orders);
         }
-
-        order_book.add(line_order);
-        write_order(fout, line_order);
-        header.update_size++;
     }
 
-    fout.close();
-    edit_header(chunk_curr_name, header);
-    source.close();
     return true;
 }
 
-bool ingest_file_not_exists(Config *conf, std::string source_file, std::string symbol)
+// Inserts a single order, with the symbol's lock held by the caller
+std::pair<std::string, bool> insert_order(Config *conf, Order &order)
 {
-    OrderBook order_book;
-    unsigned long last_trade_qty = 0;
-    unsigned long last_trade_price = 0;
-    uint64_t last_trade_epoch = 0;
-    Header header(0, 0, 1, last_trade_qty, last_trade_price, last_trade_epoch);
-    return optimized_file_ingestion(conf,
-                                    source_file,
-                                    symbol,
-                                    order_book,
-                                    header);
-}
+    EpochIndexer *indexer = conf->get_or_create_index(order.symbol);
 
-bool ingest_file_singularly(PInsert *inserter, std::string source_file, std::string symbol)
-{
-    std::ifstream source(source_file);
+    std::string filename = generate_filename(conf, order.epoch, order.symbol).first;
+    uint64_t window_start = generate_epoch_window(conf, order.epoch);
 
-    std::string file_line = "";
-    while (std::getline(source, file_line))
+    // if no file for this symbol exists, create a new one
+    if (indexer->empty())
     {
-        Order line_order = convert_line_order(file_line);
-        inserter->insert(line_order);
+        bool success = create_new_file_order(conf, indexer, window_start, order);
+        return {filename, success};
     }
 
-    source.close();
-    return true;
-}
+    // if epoch's rightful file is before any existing window, create a new one and
+    // reformat the next ones
+    if (!indexer->exists_lower(order.epoch))
+    {
+        bool success = create_new_file_order(conf, indexer, window_start, order);
+        reconfig_ahead(conf, order.epoch, order.symbol, order);
+        return {filename, success};
+    }
 
-// if symbol exists in the data AND all of the data is before
-bool ingest_file_exists(PInsert *inserter,
-                        std::string source_file,
-                        std::string symbol)
-{
-    std::ifstream source(source_file);
-    std::string first_line;
-    std::getline(source, first_line);
-    source.close();
-
-    Order line_order = convert_line_order(first_line);
-    EpochIndexer *idx = inserter->conf->get_or_create_index(symbol);
-    if (idx->exists_higher(line_order.epoch))
+    // if order is after any existing window (and its limits), query latest base and
+    // create a new file
+    if (!indexer->exists_higher(window_start))
     {
-        PQuery processor(inserter->conf);
-        QueryResult query = processor.query_timestamp(line_order.epoch, line_order.symbol);
-
-        unsigned long last_trade_qty = 0;
-        unsigned long last_trade_price = 0;
-        uint64_t last_trade_epoch = 0;
-        Header header(query.book.buy_map.size(),
-                      query.book.sell_map.size(),
-                      1,
-                      last_trade_qty,
-                      last_trade_price, last_trade_epoch);
-
-        return optimized_file_ingestion(inserter->conf,
-                                        source_file,
-                                        symbol,
-                                        query.book,
-                                        header);
+        // the chunk that was last until now is done being appended to
+        bool success = create_file_existing_symbol(conf, window_start, order);
+        conf->segments.pack(order.symbol);
+        return {filename, success};
     }
-    else
+
+    if (indexer->find(window_start))
     {
-        return ingest_file_singularly(inserter, source_file, symbol);
+        // live feeds mostly add orders after everything stored, which needs no rewrite
+        if (indexer->successor(window_start) == AVL_EMPTY_NODE && append_order_to_tail(conf, window_start, order))
+            return {filename, true};
+
+        bool success = add_order_to_file(conf, window_start, order);
+        return {filename, success};
     }
+
+    if (indexer->exists_lower(window_start) && indexer->exists_higher(window_start))
+    {
+        bool success = create_file_existing_symbol(conf, window_start, order);
+        reconfig_ahead(conf, order.epoch, order.symbol, order);
+        return {filename, success};
+    }
+
+    return {filename, false};
 }
 
-bool PInsert::ingest_file(std::string source_file, std::string symbol)
+std::pair<std::string, bool> PInsert::insert(Order &order)
 {
-    std::lock_guard<std::mutex> lock(conf->locks[symbol]);
-    EpochIndexer *indexer = conf->get_or_create_index(symbol);
-
-    if (indexer->empty())
-        return ingest_file_not_exists(conf, source_file, symbol);
-    else
-        return ingest_file_exists(this, source_file, symbol);
+    std::lock_guard<std::mutex> lock(conf->lock_for(order.symbol));
+    if (!conf->memtable_orders)
+        return insert_order(conf, order);
+
+    MemTable &table = conf->buffer.table(order.symbol);
+    bool success = table.insert(conf, order);
+    conf->buffer.written(table);
+    return {generate_filename(conf, order.epoch, order.symbol).first, success};
 }
 
-bool create_new_file_order(EpochIndexer *indexer, uint64_t window_start, std::string filename, Order &order)
+size_t PInsert::insert_batch(std::vector<Order> &orders)
 {
-    // If category is not NEW for an initial order,
-    // it cannot be processed, as there is nothing to trade or cancel
-    if (order.category != NEW)
-        return false;
+    std::unordered_map<std::string, std::vector<Order>> symbols;
+    for (Order &order : orders)
+        symbols[order.symbol].push_back(order);
 
-    Header header(0, 0, 1, 0, 0, 0);
+    size_t inserted = 0;
+    for (auto &symbol : symbols)
+    {
+        std::vector<Order> &symbol_orders = symbol.second;
+        std::stable_sort(symbol_orders.begin(), symbol_orders.end(), [](const Order &a, const Order &b)
+                         { return a.epoch < b.epoch; });
 
-    std::ofstream fout(filename, std::ios::out | std::ios::binary);
-    write_header(fout, header);
-    write_order(fout, order);
-    fout.close();
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol.first));
+        if (conf->memtable_orders)
+            conf->buffer.flush(symbol.first);
 
-    indexer->add(window_start);
+        SymbolBackfill backfill(conf, symbol.first);
+        for (Order &order : symbol_orders)
+            backfill.add(DataOrder(order));
 
-    return true;
+        backfill.finish();
+        inserted += backfill.inserted;
+    }
+
+    return inserted;
 }
 
-bool create_file_existing_symbol(Config *conf, uint64_t window_start, std::string filename, Order &order)
+double seconds_since(std::chrono::steady_clock::time_point start)
 {
-    PQuery processor(conf);
-    QueryResult query = processor.query_timestamp(order.epoch, order.symbol);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-    unsigned long buy_size = query.book.buy_map.size();
-    unsigned long sell_size = query.book.sell_map.size();
-    Header header(buy_size, sell_size, 1, query.last_trade_qty, query.last_trade_price, query.last_trade_epoch);
+// Parse, apply and write stages run on their own threads, connected by bounded rings: a reader
+// thread parses batches of orders, the calling thread applies them to the book and rolls chunks
+// over, and a writer thread writes completed chunks, so disk writes overlap with parsing and replay.
+// The writer keeps up to write_depth chunk writes in flight through io_uring where available
+bool PInsert::ingest_file(std::string source_file, std::string symbol)
+{
+    std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
 
-    std::ofstream fout(filename, std::ios::out | std::ios::binary);
-    write_header(fout, header);
-    write_base_book(fout, query.book);
-    write_order(fout, order);
-    fout.close();
+    IngestParser source(source_file);
+    if (!source.valid())
+        return false;
 
-    conf->indexes[order.symbol]->add(window_start);
+    // buffered single-order changes go first, so the file is ingested on top of them
+    if (conf->memtable_orders)
+        conf->buffer.flush(symbol);
 
-    return true;
-}
+    stats = IngestStats();
+    stats.bytes = fs::file_size(source_file);
+    double tick_size = conf->tick_size(symbol);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-bool add_order_to_file(Config *conf, std::string filename, Order &order)
-{
-    std::string old_name = filename;
-    remove_string_end(4, old_name);
-    old_name.append(OLD);
-    fs::rename(filename, old_name);
+    SpscRing<std::vector<DataOrder>> parsed(PARSED_QUEUE);
+    SpscRing<PendingChunk> chunks(CHUNK_QUEUE);
+    size_t failed_writes = 0; // only touched by the writer thread until it is joined
 
-    std::ifstream fin(old_name, std::ios::in | std::ios::binary);
-    std::ofstream fout(filename, std::ios::out | std::ios::binary);
+    std::thread parser([&]()
+                       {
+        std::vector<DataOrder> batch;
+        batch.reserve(INGEST_BATCH);
 
-    Header header;
-    fin.read((char *)&header, sizeof(Header));
-    header.update_size++;
+        IngestLine line;
+        while (source.next(line))
+        {
+            batch.push_back(line.ticked(tick_size));
+            if (batch.size() < INGEST_BATCH)
+                continue;
+
+            stats.parse.items += batch.size();
+            parsed.push(std::move(batch));
+            batch = std::vector<DataOrder>();
+            batch.reserve(INGEST_BATCH);
+        }
 
-    OrderBook book;
-    for (int j = 0; j < header.base_buy; j++)
+        stats.parse.items += batch.size();
+        if (!batch.empty())
+            parsed.push(std::move(batch));
+
+        parsed.close();
+        stats.parse.seconds = seconds_since(start); });
+
+    std::thread writer([&]()
+                       {
+        // chunks are serialized into the writer's own buffers, so each one is free again after submit
+        ChunkWriter chunk_writer(conf->write_depth, conf->order_layout);
+        EpochIndexer *idx = conf->get_or_create_index(symbol);
+        bool has_keyframes = conf->keyframe_windows(symbol) > 1;
+
+        // chunks come in window order, so a group's keyframe is the first chunk written in it, or
+        // the stored one they carry on from. It is kept here, as it is only indexed once written
+        Keyframe keyframe;
+        StoredBase stored;
+        PendingChunk chunk;
+        while (chunks.pop(chunk))
+        {
+            std::string filename = generate_filename(conf, chunk.epoch, symbol).first;
+            uint64_t epoch = chunk.epoch;
+            // a stored chunk the file carries on into is rewritten in files of its own
+            conf->segments.unpack(symbol, epoch);
+            prepare_header(conf, symbol, chunk.header, chunk.base, chunk.checkpoints, chunk.orders);
+
+            bool has_keyframe = has_keyframes &&
+                                ((keyframe.epoch != NO_BASE_REF &&
+                                  keyframe_group(conf, symbol, keyframe.epoch) == keyframe_group(conf, symbol, epoch)) ||
+                                 find_keyframe(conf, symbol, epoch, keyframe));
+            encode_base(chunk.header, chunk.base, has_keyframe ? &keyframe : nullptr, stored);
+
+            chunk_writer.submit(filename, chunk.header, *stored.buys, *stored.sells, chunk.checkpoints.entries,
+                                chunk.checkpoints.levels, chunk.orders, [&, filename, epoch](bool is_written)
+                                {
+                conf->chunks.invalidate(filename);
+                conf->decoded.invalidate(symbol, epoch);
+                if (is_written)
+                {
+                    idx->add(epoch);
+                    stats.write.items++;
+                }
+                else
+                    failed_writes++; });
+
+            if (has_keyframes && !has_keyframe)
+            {
+                keyframe.epoch = epoch;
+                keyframe.stamp = chunk.header.base_stamp;
+                keyframe.base = chunk.base;
+            }
+        }
+
+        chunk_writer.wait_all();
+        stats.write.seconds = seconds_since(start); });
+
+    std::unique_ptr<SymbolIngest> ingest;
+    std::unique_ptr<SymbolBackfill> backfill;
+    bool is_first = true;
+    std::vector<DataOrder> batch;
+    while (parsed.pop(batch))
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.buy_map[entry.price] = entry;
+        for (DataOrder &order : batch)
+        {
+            if (is_first)
+            {
+                ingest = start_symbol_ingest(conf, symbol, order.epoch);
+                if (ingest)
+                    ingest->on_chunk = [&](PendingChunk &chunk)
+                    { chunks.push(std::move(chunk)); };
+                else
+                    backfill = std::make_unique<SymbolBackfill>(conf, symbol);
+
+                is_first = false;
+            }
+
+            if (ingest)
+                ingest->add(order);
+            else
+                backfill->add(order);
+        }
+
+        stats.apply.items += batch.size();
     }
 
-    for (int j = 0; j < header.base_sell; j++)
+    if (ingest)
+        ingest->finish();
+    if (backfill)
+        backfill->finish();
+
+    chunks.close();
+    stats.apply.seconds = seconds_since(start);
+
+    parser.join();
+    writer.join();
+    conf->segments.pack(symbol);
+
+    RingStats parsed_stats = parsed.stats();
+    RingStats chunk_stats = chunks.stats();
+    stats.parse.waiting = parsed_stats.push_wait;
+    stats.apply.waiting = parsed_stats.pop_wait + chunk_stats.push_wait;
+    stats.write.waiting = chunk_stats.pop_wait;
+    stats.parsed_queue = {parsed_stats.capacity, parsed_stats.peak, parsed_stats.mean};
+    stats.chunk_queue = {chunk_stats.capacity, chunk_stats.peak, chunk_stats.mean};
+
+    return failed_writes == 0;
+}
+
+// Writer of one symbol within a market ingestion, holding the symbol's lock until its orders so
+// far are written out
+struct SymbolWriter
+{
+    std::unique_lock<std::mutex> lock;
+    std::chrono::steady_clock::time_point locked_at;
+    double tick_size;
+    std::unique_ptr<SymbolIngest> ingest;
+    std::unique_ptr<SymbolBackfill> backfill; // only set when the symbol's orders land within stored chunks
+};
+
+static void finish_writer(SymbolWriter &writer)
+{
+    if (writer.ingest)
+        writer.ingest->finish();
+    else
+        writer.backfill->finish();
+}
+
+// Writes out and releases the symbols held for MARKET_LOCK_HOLD or longer
+static void release_writers(std::unordered_map<std::string_view, SymbolWriter> &writers)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (auto writer = writers.begin(); writer != writers.end();)
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.sell_map[entry.price] = entry;
+        if (now - writer->second.locked_at < MARKET_LOCK_HOLD)
+        {
+            writer++;
+            continue;
+        }
+
+        finish_writer(writer->second);
+        writer = writers.erase(writer);
     }
+}
 
-    write_header(fout, header);
-    write_base_book(fout, book);
+// A symbol is written out and released once it was held for MARKET_LOCK_HOLD, also while the
+// worker waits for rows, so other writers and queries of the symbol don't wait for the whole
+// file. Its next rows pick up from whatever is stored by then
+void run_market_worker(Config *conf, SpscRing<std::vector<IngestLine>> &queue)
+{
+    std::unordered_map<std::string_view, SymbolWriter> writers;
+    std::set<std::string_view> symbols;
+    std::vector<IngestLine> batch;
 
-    // Transfering updates for this file to new copy
-    bool is_written = false;
-    for (int j = 0; j < header.update_size - 1; j++)
+    while (!queue.drained())
     {
-        DataOrder stored_order;
-        fin.read((char *)&stored_order, sizeof(DataOrder));
+        if (!queue.try_pop(batch))
+        {
+            release_writers(writers);
+            std::this_thread::yield();
+            continue;
+        }
 
-        if (order.epoch < stored_order.epoch)
+        for (IngestLine &line : batch)
         {
-            write_order(fout, order);
-            is_written = true;
+            auto found = writers.find(line.symbol);
+            if (found == writers.end())
+            {
+                std::string symbol(line.symbol);
+                SymbolWriter writer;
+                writer.lock = std::unique_lock<std::mutex>(conf->lock_for(symbol));
+                writer.locked_at = std::chrono::steady_clock::now();
+                if (conf->memtable_orders)
+                    conf->buffer.flush(symbol);
+                writer.tick_size = conf->tick_size(symbol);
+                writer.ingest = start_symbol_ingest(conf, symbol, line.order.epoch);
+                if (!writer.ingest)
+                    writer.backfill = std::make_unique<SymbolBackfill>(conf, symbol);
+                found = writers.emplace(line.symbol, std::move(writer)).first;
+                symbols.insert(line.symbol);
+            }
+
+            SymbolWriter &writer = found->second;
+            DataOrder order = line.ticked(writer.tick_size);
+            if (writer.ingest)
+                writer.ingest->add(order);
+            else
+                writer.backfill->add(order);
         }
 
-        fout.write((char *)&stored_order, sizeof(DataOrder));
+        release_writers(writers);
     }
 
-    if (!is_written)
+    for (auto &writer : writers)
+        finish_writer(writer.second);
+    writers.clear();
+
+    for (std::string_view symbol_view : symbols)
     {
-        write_order(fout, order);
+        std::string symbol(symbol_view);
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+        conf->segments.pack(symbol);
     }
-
-    fout.close();
-    fin.close();
-    fs::remove(old_name);
-
-    reconfig_ahead(conf, order.epoch, order.symbol, order);
-    return true;
 }
 
-std::pair<std::string, bool> PInsert::insert(Order &order)
+// Rows are demultiplexed by symbol onto the workers, so every symbol is only ever written by one
+// worker and still sees its orders in file order. Symbol names point into the parser's mapping,
+// which outlives the workers
+bool PInsert::ingest_market_file(std::string source_file)
 {
-    std::lock_guard<std::mutex> lock(conf->locks[order.symbol]);
-    EpochIndexer *indexer = conf->get_or_create_index(order.symbol);
+    IngestParser source(source_file);
+    if (!source.valid())
+        return false;
 
-    std::string filename = generate_filename(conf, order.epoch, order.symbol).first;
-    uint64_t window_start = generate_epoch_window(conf, order.epoch);
+    unsigned int workers = conf->ingest_threads ? conf->ingest_threads : std::thread::hardware_concurrency();
+    if (workers == 0)
+        workers = 1;
 
-    // if no file for this symbol exists, create a new one
-    if (indexer->empty())
+    std::vector<std::unique_ptr<SpscRing<std::vector<IngestLine>>>> queues;
+    std::vector<std::vector<IngestLine>> pending(workers);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < workers; i++)
     {
-        bool success = create_new_file_order(indexer, window_start, filename, order);
-        return {filename, success};
+        queues.push_back(std::make_unique<SpscRing<std::vector<IngestLine>>>(MARKET_QUEUE));
+        pending[i].reserve(MARKET_BATCH);
+        threads.push_back(std::thread(run_market_worker, conf, std::ref(*queues[i])));
     }
 
-    // if epoch's rightful file is before any existing window, create a new one and
-    // reformat the next ones
-    if (!indexer->exists_lower(order.epoch))
+    std::hash<std::string_view> symbol_hash;
+    IngestLine line;
+    while (source.next(line))
     {
-        bool success = create_new_file_order(indexer, window_start, filename, order);
-        reconfig_ahead(conf, order.epoch, order.symbol, order);
-        return {filename, success};
+        size_t worker = symbol_hash(line.symbol) % workers;
+        pending[worker].push_back(line);
+        if (pending[worker].size() < MARKET_BATCH)
+            continue;
+
+        queues[worker]->push(std::move(pending[worker]));
+        pending[worker] = std::vector<IngestLine>();
+        pending[worker].reserve(MARKET_BATCH);
     }
 
-    // if order is after any existing window (and its limits), query latest base and
-    // create a new file
-    if (!indexer->exists_higher(window_start))
+    for (unsigned int i = 0; i < workers; i++)
     {
-        bool success = create_file_existing_symbol(conf, window_start, filename, order);
-        return {filename, success};
-    }
+        if (!pending[i].empty())
+            queues[i]->push(std::move(pending[i]));
 
-    if (indexer->find(window_start))
-    {
-        bool success = add_order_to_file(conf, filename, order);
-        return {filename, success};
+        queues[i]->close();
     }
 
-    if (indexer->exists_lower(window_start) && indexer->exists_higher(window_start))
-    {
-        bool success = create_file_existing_symbol(conf, window_start, filename, order);
-        reconfig_ahead(conf, order.epoch, order.symbol, order);
-        return {filename, success};
-    }
+    for (std::thread &thread : threads)
+        thread.join();
 
-    return {filename, false};
-}
\ No newline at end of file
+    return true;
+}
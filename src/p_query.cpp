@@ -1,151 +1,547 @@
 #include "include/p_query.hpp"
 #include "include/order_book.hpp"
 #include "header.hpp"
+#include "order_columns.hpp"
 #include "shared.hpp"
 #include "indexer.hpp"
 #include <algorithm>
 #include <filesystem>
-#include <fstream>
+#include <functional>
+#include <memory>
 #include <utility>
 #include <vector>
 
 PQuery::PQuery(Config *conf) : conf(conf) {}
 
-QueryResult proc_for_epoch(Config *conf, uint64_t epoch, uint64_t file_epoch, std::string symbol)
+// Moves the replay of a chunk forward to the epoch. The replay jumps to the latest checkpoint
+// at or before the epoch whenever that checkpoint is ahead of it, and only starts from the
+// base state if it wasn't loaded yet and no checkpoint helps
+void replay_chunk_to(const DecodedChunk &chunk,
+                     uint64_t epoch,
+                     OrderBook &book,
+                     Header &trades,
+                     unsigned long &applied,
+                     bool &is_loaded,
+                     std::string &symbol)
 {
-    std::pair<std::string, uint64_t> file_pair =
-        generate_filename(conf, file_epoch, symbol);
+    const std::vector<Checkpoint> &checkpoints = chunk.checkpoints;
+    const std::vector<DataOrder> &orders = chunk.orders;
 
-    std::ifstream fin(file_pair.first, std::ios::in | std::ios::binary);
+    auto after = std::upper_bound(checkpoints.begin(), checkpoints.end(), epoch,
+                                               [](uint64_t epoch, const Checkpoint &checkpoint)
+                                               { return epoch < checkpoint.epoch; });
 
-    Header header;
-    fin.read((char *)&header, sizeof(Header));
+    if (after != checkpoints.begin() && (after - 1)->order_count > applied)
+    {
+        const Checkpoint &checkpoint = *(after - 1);
+        book = OrderBook();
+        chunk.checkpoint_book(after - 1 - checkpoints.begin(), book);
+
+        trades.last_trade_qty = checkpoint.last_trade_qty;
+        trades.last_trade_price = checkpoint.last_trade_price;
+        trades.last_trade_epoch = checkpoint.last_trade_epoch;
+        applied = checkpoint.order_count;
+        is_loaded = true;
+    }
+    else if (!is_loaded)
+    {
+        book = chunk.base;
+        is_loaded = true;
+    }
+
+    while (applied < orders.size() && orders[applied].epoch <= epoch)
+    {
+        DataOrder stored_order = orders[applied];
+        replay_order(book, trades, stored_order, symbol);
+        applied++;
+    }
+}
+
+// Replays a chunk once, taking a snapshot each time the replay reaches one of the requested
+// epochs (which have to be sorted in ascending order). A depth limits the levels per side
+// in every snapshot, 0 keeping the full book
+std::vector<QueryResult> proc_for_epochs(Config *conf,
+                                         const std::vector<uint64_t> &epochs,
+                                         uint64_t file_epoch,
+                                         std::string symbol,
+                                         size_t depth)
+{
+    std::vector<QueryResult> results;
+    results.reserve(epochs.size());
 
+    std::shared_ptr<const DecodedChunk> chunk = load_chunk(conf, symbol, file_epoch);
+    if (!chunk)
+    {
+        results.resize(epochs.size());
+        return results;
+    }
+
+    Header header = chunk->header;
     OrderBook book;
-    for (int j = 0; j < header.base_buy; j++)
+    bool is_loaded = false;
+    unsigned long applied = 0;
+    for (uint64_t epoch : epochs)
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.buy_map[entry.price] = entry;
+        replay_chunk_to(*chunk, epoch, book, header, applied, is_loaded, symbol);
+
+        // the replay needs the whole book, but only the best levels are copied out
+        results.push_back(QueryResult(book.top(depth),
+                                      header.last_trade_epoch,
+                                      header.last_trade_qty,
+                                      header.last_trade_price));
     }
 
-    for (int j = 0; j < header.base_sell; j++)
+    return results;
+}
+
+QueryResult proc_for_epoch(Config *conf, uint64_t epoch, uint64_t file_epoch, std::string symbol, size_t depth)
+{
+    return proc_for_epochs(conf, {epoch}, file_epoch, symbol, depth)[0];
+}
+
+// Only the best depth levels of the stored base state are copied out, straight from the chunk's
+// mapping. Diffs against a keyframe and chunks missing logged changes go through the decoded
+// chunk instead, which has both applied
+QueryResult get_base_epoch(Config *conf, uint64_t epoch, uint64_t file_epoch, std::string symbol, size_t depth)
+{
+    DeltaLog &symbol_log = conf->deltas.log(symbol);
+    uint64_t trims = symbol_log.trims();
+
+    std::shared_ptr<ChunkReader> reader = open_chunk(conf, symbol, file_epoch);
+    if (!reader->valid())
+        return QueryResult();
+
+    const Header &header = reader->header();
+    BaseShift shift;
+    symbol_log.collect(file_epoch, header.delta_seq, shift);
+    if (header.base_ref == NO_BASE_REF && shift.empty() && symbol_log.trims() == trims)
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.sell_map[entry.price] = entry;
+        OrderBook book;
+        reader->base_book(book, depth);
+        return QueryResult(book, header.last_trade_epoch, header.last_trade_qty, header.last_trade_price);
     }
 
-    for (int j = 0; j < header.update_size; j++)
+    std::shared_ptr<const DecodedChunk> chunk = load_chunk(conf, symbol, file_epoch);
+    if (!chunk)
+        return QueryResult();
+
+    const Header &decoded_header = chunk->header;
+    return QueryResult(chunk->base.top(depth), decoded_header.last_trade_epoch, decoded_header.last_trade_qty, decoded_header.last_trade_price);
+}
+
+// Stored state with the symbol's buffered changes merged in, through a cursor stopping at the epoch
+QueryResult PQuery::query_timestamp(uint64_t epoch, std::string symbol, size_t depth)
+{
+    if (!conf->memtable_orders || !conf->buffer.has_pending(symbol))
+        return query_stored(epoch, symbol, depth);
+
+    RangeCursor cursor(conf, symbol, epoch, epoch, 0);
+    QueryResult result = cursor.snapshot();
+    result.book = result.book.top(depth);
+    return result;
+}
+
+QueryResult PQuery::query_stored(uint64_t epoch, std::string symbol, size_t depth)
+{
+    if (!fs::exists(conf->data_dir + symbol + "/"))
+        return QueryResult();
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+
+    // if there are no orders on or before this epoch, empty result is returned
+    uint64_t file_epoch = idx->floor(epoch);
+    if (file_epoch == AVL_EMPTY_NODE)
+        return QueryResult();
+
+    // if epoch is within one file, then search in that file
+    if (epoch < file_epoch + conf->epoch_window)
+        return proc_for_epoch(conf, epoch, file_epoch, symbol, depth);
+
+    // if epoch is in middle of two files, get base from the next -
+    // or if the epoch is after all files, calculate the base from the last one
+    uint64_t next_epoch = idx->successor(file_epoch);
+    if (next_epoch != AVL_EMPTY_NODE)
+        return get_base_epoch(conf, epoch, next_epoch, symbol, depth);
+
+    return proc_for_epoch(conf, epoch, file_epoch, symbol, depth);
+}
+
+// One pass over the chunks: epochs are sorted and grouped by the chunk window they fall in,
+// so that each chunk is opened and replayed at most once for all of its epochs
+std::vector<QueryResult> query_stored_multiple(Config *conf, const std::vector<uint64_t> &epochs, std::string symbol, size_t depth)
+{
+    std::vector<QueryResult> result(epochs.size());
+    if (epochs.empty() || !fs::exists(conf->data_dir + symbol + "/"))
+        return result;
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+
+    // positions of the requested epochs, in ascending epoch order
+    std::vector<size_t> positions(epochs.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = i;
+
+    std::stable_sort(positions.begin(), positions.end(), [&](size_t a, size_t b)
+                     { return epochs[a] < epochs[b]; });
+
+    size_t i = 0;
+    while (i < positions.size())
     {
-        DataOrder stored_order;
-        fin.read((char *)&stored_order, sizeof(DataOrder));
-        if (epoch < stored_order.epoch)
-            break;
+        uint64_t epoch = epochs[positions[i]];
+
+        // if there are no orders on or before this epoch, empty result is kept
+        uint64_t file_epoch = idx->floor(epoch);
+        if (file_epoch == AVL_EMPTY_NODE)
+        {
+            i++;
+            continue;
+        }
+
+        uint64_t window_end = file_epoch + conf->epoch_window;
+        uint64_t next_epoch = idx->successor(file_epoch);
 
-        if (stored_order.category == TRADE)
+        // epochs in between two files all share the base of the next file
+        if (epoch >= window_end && next_epoch != AVL_EMPTY_NODE)
         {
-            header.last_trade_epoch = stored_order.epoch;
-            header.last_trade_qty = stored_order.qty;
-            header.last_trade_price = stored_order.price;
+            QueryResult base = get_base_epoch(conf, epoch, next_epoch, symbol, depth);
+            while (i < positions.size() && epochs[positions[i]] < next_epoch)
+                result[positions[i++]] = base;
+
+            continue;
         }
 
-        Order new_order =
-            Order(symbol, stored_order.epoch, stored_order.id, stored_order.side,
-                  stored_order.category, stored_order.qty, stored_order.price);
+        // epochs within this file (or after all files) are taken from a single replay
+        size_t group_start = i;
+        std::vector<uint64_t> group;
+        while (i < positions.size() && (next_epoch == AVL_EMPTY_NODE || epochs[positions[i]] < window_end))
+            group.push_back(epochs[positions[i++]]);
 
-        book.add(new_order);
+        std::vector<QueryResult> snapshots = proc_for_epochs(conf, group, file_epoch, symbol, depth);
+        for (size_t j = 0; j < snapshots.size(); j++)
+            result[positions[group_start + j]] = snapshots[j];
     }
 
-    fin.close();
-    return QueryResult(book,
-                       header.last_trade_epoch,
-                       header.last_trade_qty,
-                       header.last_trade_price);
+    return result;
 }
 
-QueryResult get_base_epoch(Config *conf, uint64_t epoch, uint64_t file_epoch, std::string symbol)
+// Buffered changes are merged in like in query_timestamp, with one cursor moving through the
+// epochs in ascending order
+std::vector<QueryResult> PQuery::query_multiple(const std::vector<uint64_t> &epochs, std::string symbol, size_t depth)
 {
-    std::pair<std::string, uint64_t> file_pair =
-        generate_filename(conf, file_epoch, symbol);
+    if (epochs.empty() || !conf->memtable_orders || !conf->buffer.has_pending(symbol))
+        return query_stored_multiple(conf, epochs, symbol, depth);
 
-    std::ifstream fin(file_pair.first, std::ios::in | std::ios::binary);
+    std::vector<size_t> positions(epochs.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        positions[i] = i;
 
-    Header header;
-    fin.read((char *)&header, sizeof(Header));
+    std::stable_sort(positions.begin(), positions.end(), [&](size_t a, size_t b)
+                     { return epochs[a] < epochs[b]; });
 
-    OrderBook book;
-    for (int j = 0; j < header.base_buy; j++)
+    std::vector<QueryResult> result(epochs.size());
+    RangeCursor cursor(conf, symbol, epochs[positions.front()], epochs[positions.back()], 0);
+    for (size_t position : positions)
+    {
+        cursor.advance(epochs[position]);
+        result[position] = cursor.snapshot();
+        result[position].book = result[position].book.top(depth);
+    }
+
+    return result;
+}
+
+// Traded qty of a chunk's stored orders between the epochs. Columns are searched and summed a
+// field at a time, raw records straight from the mapping, and only an encoded log is decoded
+static uint64_t chunk_traded_qty(Config *conf, std::string &symbol, uint64_t file_epoch, uint64_t start, uint64_t end)
+{
+    std::shared_ptr<ChunkReader> reader = open_chunk(conf, symbol, file_epoch);
+    if (!reader->valid())
+        return 0;
+
+    if (reader->header().order_layout == ORDER_COLUMNS)
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.buy_map[entry.price] = entry;
+        const OrderColumns &columns = reader->columns();
+        size_t first = epoch_lower_bound(columns.epochs, columns.count, start);
+        size_t last = end == UINT64_MAX ? columns.count : epoch_lower_bound(columns.epochs, columns.count, end + 1);
+        return traded_qty(columns, first, last);
     }
 
-    for (int j = 0; j < header.base_sell; j++)
+    std::vector<DataOrder> decoded;
+    Span<DataOrder> orders = reader->orders();
+    if (reader->header().order_layout == ORDER_LOG)
     {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.sell_map[entry.price] = entry;
+        if (!reader->read_orders(decoded))
+            return 0;
+        orders = Span<DataOrder>(decoded.data(), decoded.size());
     }
 
-    fin.close();
-    return QueryResult(book, header.last_trade_epoch, header.last_trade_qty, header.last_trade_price);
+    size_t first = epoch_lower_bound(orders.begin(), orders.size(), start);
+    size_t last = end == UINT64_MAX ? orders.size() : epoch_lower_bound(orders.begin(), orders.size(), end + 1);
+    return first < last ? traded_qty(orders.begin() + first, last - first) : 0;
 }
 
-QueryResult PQuery::query_timestamp(uint64_t epoch, std::string symbol)
+// Buffered changes are added on top of the stored orders: inserted trades count, and the stored
+// version of every updated or deleted order is swapped for its buffered one. The symbol stays
+// locked throughout, so a flush can't move buffered orders into the chunks halfway
+uint64_t PQuery::traded_volume(uint64_t start, uint64_t end, std::string symbol)
 {
-    if (!fs::exists(conf->data_dir + symbol + "/"))
-        return QueryResult();
+    if (start > end)
+        return 0;
 
-    // calculating
-    EpochIndexer *idx = conf->get_or_create_index(symbol);
-    std::vector<uint64_t> file_epochs = idx->epoch_list();
+    std::unique_lock<std::mutex> lock;
+    const MemSnapshot *pending = nullptr;
+    if (conf->memtable_orders)
+    {
+        lock = std::unique_lock<std::mutex>(conf->lock_for(symbol));
+        if (conf->buffer.has_pending(symbol))
+            pending = &conf->buffer.table(symbol).pending;
+    }
 
-    // if there are no orders on or before this epoch, empty result is returned
-    if (file_epochs.empty() || epoch < file_epochs[0])
-        return QueryResult();
+    uint64_t total = 0;
+    if (fs::exists(conf->data_dir + symbol + "/"))
+    {
+        EpochIndexer *idx = conf->get_or_create_index(symbol);
+        uint64_t file_epoch = idx->floor(start);
+        if (file_epoch == AVL_EMPTY_NODE)
+            file_epoch = idx->ceiling(start);
+
+        for (; file_epoch != AVL_EMPTY_NODE && file_epoch <= end; file_epoch = idx->successor(file_epoch))
+            total += chunk_traded_qty(conf, symbol, file_epoch, start, end);
+    }
+
+    if (!pending)
+        return total;
 
-    QueryResult query_result;
+    auto in_range = [&](const DataOrder &order)
+    { return order.category == TRADE && order.epoch >= start && order.epoch <= end; };
 
-    // if the epoch is after all files, calculate the base and return result
-    if (epoch > file_epochs[file_epochs.size() - 1] + conf->epoch_window)
+    for (const DataOrder &order : pending->inserts)
+        if (in_range(order))
+            total += order.qty;
+
+    for (auto &entry : pending->edits)
     {
-        query_result = proc_for_epoch(conf, epoch, file_epochs[file_epochs.size() - 1], symbol);
+        const MemEdit &edit = entry.second;
+        if (in_range(edit.stored))
+            total -= edit.stored.qty;
+        if (!edit.is_delete && in_range(edit.updated))
+            total += edit.updated.qty;
     }
-    else
+
+    return total;
+}
+
+RangeCursor PQuery::query_range(uint64_t start, uint64_t end, uint64_t step, std::string symbol)
+{
+    return RangeCursor(conf, symbol, start, end, step);
+}
+
+void PQuery::query_range(uint64_t start,
+                         uint64_t end,
+                         std::string symbol,
+                         std::function<void(const DataOrder &, const QueryResult &)> on_event)
+{
+    RangeCursor cursor(conf, symbol, start, end, 0);
+    while (cursor.next())
+        on_event(cursor.last_order(), cursor.snapshot());
+}
+
+// Buffered changes are copied once. The symbol is only locked while the cursor is set up and
+// while it moves on to another chunk, as the flusher rewrites chunks and the index under its lock
+RangeCursor::RangeCursor(Config *conf, std::string symbol, uint64_t start, uint64_t end, uint64_t step)
+    : conf(conf), symbol(symbol), end(end), step(step), curr_epoch(start)
+{
+    if (start > end)
     {
-        unsigned int i = 0;
-        while (i < file_epochs.size())
-        {
-            uint64_t file_epoch = file_epochs[i];
+        is_done = true;
+        return;
+    }
 
-            // if epoch is within one file, then search in that file -
-            // or if epoch is in middle of two files, get base from the next
-            if (epoch >= file_epoch && epoch < file_epoch + conf->epoch_window)
+    std::unique_lock<std::mutex> lock;
+    if (conf->memtable_orders)
+    {
+        lock = std::unique_lock<std::mutex>(conf->lock_for(symbol));
+        if (conf->buffer.has_pending(symbol))
+        {
+            MemTable &table = conf->buffer.table(symbol);
+            if (!table.pending.empty())
             {
-                query_result = proc_for_epoch(conf, epoch, file_epoch, symbol);
-                break;
-            }
-            else if (epoch < file_epoch) {
-                query_result = get_base_epoch(conf, epoch, file_epoch, symbol);
-                break;
+                pending = std::make_shared<const MemSnapshot>(table.pending);
+                flushes = table.flushes;
             }
-            
-            i++;
         }
     }
-    
-    return query_result;
+
+    // stored orders only give the right state before the first buffered change, so with one at or
+    // before the start the cursor is opened there and replays both up to the start
+    uint64_t opened_at = start;
+    if (pending && pending->first_epoch() <= start)
+        opened_at = pending->first_epoch() ? pending->first_epoch() - 1 : 0;
+
+    if (fs::exists(conf->data_dir + symbol + "/"))
+        open_stored(opened_at);
+    else if (!pending)
+        is_done = true;
+
+    // moving on to the next chunk takes the lock again
+    if (lock.owns_lock())
+        lock.unlock();
+
+    if (opened_at != start)
+        advance(start);
 }
 
-std::vector<QueryResult> PQuery::query_multiple(const std::vector<uint64_t> &epochs, std::string symbol)
+// Replays the stored orders up to the start
+void RangeCursor::open_stored(uint64_t start)
 {
-    std::vector<QueryResult> result;
-    for (uint64_t epoch : epochs)
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    Header trades(0, 0, 0, 0, 0, 0);
+
+    // replay the chunk covering the start (or the last one before it) up to the start -
+    // or if nothing is stored before the start, begin from the base of the first chunk after
+    file_epoch = idx->floor(start);
+    if (file_epoch == AVL_EMPTY_NODE)
     {
-        QueryResult query = query_timestamp(epoch, symbol);
-        result.push_back(query);
+        file_epoch = idx->ceiling(start);
+        if (file_epoch == AVL_EMPTY_NODE)
+            return;
+
+        is_open = true;
+        chunk = load_chunk(conf, symbol, file_epoch);
+        if (chunk)
+        {
+            state.book = chunk->base;
+            trades = chunk->header;
+        }
     }
-    return result;
+    else
+    {
+        is_open = true;
+        chunk = load_chunk(conf, symbol, file_epoch);
+        if (chunk)
+        {
+            bool is_loaded = false;
+            trades = chunk->header;
+            replay_chunk_to(*chunk, start, state.book, trades, applied, is_loaded, symbol);
+        }
+    }
+
+    state.last_trade_epoch = trades.last_trade_epoch;
+    state.last_trade_qty = trades.last_trade_qty;
+    state.last_trade_price = trades.last_trade_price;
+}
+
+// Next stored order if it is at or before the epoch, moving on to the
+// next chunk (without reading its base state) once the current one runs out
+const DataOrder *RangeCursor::peek_stored(uint64_t until)
+{
+    while (is_open)
+    {
+        static const std::vector<DataOrder> no_orders;
+        const std::vector<DataOrder> &orders = chunk ? chunk->orders : no_orders;
+        if (applied < orders.size())
+            return orders[applied].epoch <= until ? &orders[applied] : nullptr;
+
+        std::unique_lock<std::mutex> lock;
+        if (conf->memtable_orders)
+            lock = std::unique_lock<std::mutex>(conf->lock_for(symbol));
+
+        uint64_t next_file = conf->get_or_create_index(symbol)->successor(file_epoch);
+        if (next_file == AVL_EMPTY_NODE || next_file > until)
+            return nullptr;
+
+        // a flush since the copy merged all of it into the chunks, so the ones not read yet
+        // already hold it
+        if (pending && flushed_from == UINT64_MAX && conf->buffer.table(symbol).flushes != flushes)
+            flushed_from = next_file;
+
+        file_epoch = next_file;
+        chunk = load_chunk(conf, symbol, file_epoch);
+        applied = 0;
+    }
+
+    return nullptr;
+}
+
+// Applies the next order at or before the epoch, taking stored and buffered orders in epoch order
+// (stored ones first within an epoch), with buffered updates and deletes of stored orders applied.
+// Buffered changes the chunks were found to hold already are left to the chunks
+bool RangeCursor::next_order(uint64_t until)
+{
+    while (true)
+    {
+        const DataOrder *stored = peek_stored(until);
+        const DataOrder *buffered = nullptr;
+        if (pending && next_insert < pending->inserts.size() && pending->inserts[next_insert].epoch <= until &&
+            pending->inserts[next_insert].epoch < flushed_from)
+            buffered = &pending->inserts[next_insert];
+
+        if (!stored && !buffered)
+            return false;
+
+        if (stored && (!buffered || stored->epoch <= buffered->epoch))
+        {
+            event = *stored;
+            applied++;
+            if (pending && event.epoch < flushed_from && !pending->edit_stored(event))
+                continue;
+        }
+        else
+        {
+            event = *buffered;
+            next_insert++;
+        }
+
+        if (event.category == TRADE)
+        {
+            state.last_trade_epoch = event.epoch;
+            state.last_trade_qty = event.qty;
+            state.last_trade_price = event.price;
+        }
+
+        Order order(symbol, event.epoch, event.id, event.side, event.category, event.qty, event.price);
+        state.book.add(order);
+        return true;
+    }
+}
+
+void RangeCursor::advance(uint64_t epoch)
+{
+    while (next_order(epoch))
+        ;
+}
+
+bool RangeCursor::next()
+{
+    if (is_done)
+        return false;
+
+    // every order within the range is its own stop
+    if (step == 0)
+    {
+        if (!next_order(end))
+        {
+            is_done = true;
+            return false;
+        }
+
+        curr_epoch = event.epoch;
+        return true;
+    }
+
+    if (is_started)
+    {
+        if (end - curr_epoch < step)
+        {
+            is_done = true;
+            return false;
+        }
+
+        curr_epoch += step;
+    }
+
+    is_started = true;
+    advance(curr_epoch);
+
+    return true;
 }
@@ -4,10 +4,13 @@
 #include "include/order.hpp"
 #include "header.hpp"
 #include "shared.hpp"
+#include "symbol_ingest.hpp"
+#include <algorithm>
 #include <mutex>
 #include <thread>
 #include <filesystem>
 #include <fstream>
+#include <unordered_map>
 #include <utility>
 #include <stdint.h>
 
@@ -37,62 +40,76 @@ void reconfig_difference(Config *conf, Order &a, DataOrder &b)
 
 bool PUpdate::update_order(Order &order)
 {
-    std::lock_guard<std::mutex> lock(conf->locks[order.symbol]);
+    std::lock_guard<std::mutex> lock(conf->lock_for(order.symbol));
+    if (conf->memtable_orders)
+    {
+        MemTable &table = conf->buffer.table(order.symbol);
+        bool success = table.update(conf, order);
+        conf->buffer.written(table);
+        return success;
+    }
 
-    if (!conf->indexes[order.symbol]->find(generate_epoch_window(conf, order.epoch)))
+    if (!conf->get_or_create_index(order.symbol)->find(generate_epoch_window(conf, order.epoch)))
         return false;
 
     std::pair<std::string, uint64_t> filename =
         generate_filename(conf, order.epoch, order.symbol);
 
-    std::ifstream fin(filename.first, std::ios::in | std::ios::binary);
-
     Header header;
-    fin.read((char *)&header, sizeof(Header));
-
     OrderBook book;
-    for (int i = 0; i < header.base_buy; i++)
-    {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.buy_map[entry.price] = entry;
-    }
+    std::vector<DataOrder> orders;
+    read_chunk(conf, order.symbol, filename.second, header, book, orders);
 
-    for (int i = 0; i < header.base_sell; i++)
-    {
-        OrderEntry entry;
-        fin.read((char *)&entry, sizeof(OrderEntry));
-        book.sell_map[entry.price] = entry;
-    }
+    auto found = std::find_if(orders.begin(), orders.end(), [&](const DataOrder &stored_order)
+                              { return stored_order.id == order.id && stored_order.epoch == order.epoch; });
 
-    DataOrder stored_order;
-    uint64_t start_idx = 0;
-    bool is_found = false;
-    for (int i = 0; i < header.update_size; i++)
-    {
-        fin.read((char *)&stored_order, sizeof(DataOrder));
-        if (stored_order.id == order.id && stored_order.epoch == order.epoch)
-        {
-            start_idx = fin.tellg();
-            start_idx -= sizeof(DataOrder);
-            is_found = true;
-            break;
-        }
-    }
-
-    fin.close();
-
-    if (!is_found || stored_order.epoch != order.epoch || stored_order.id != order.id)
+    if (found == orders.end())
         return false;
 
-    DataOrder new_replacement(order);
-    std::fstream fstr(filename.first, std::ios::binary | std::ios::out | std::ios::in);
-    fstr.seekp(start_idx);
-    fstr.write((char *)&new_replacement, sizeof(DataOrder));
-    fstr.close();
-    
-    if (conf->indexes[order.symbol]->exists_higher(order.epoch))
+    // the chunk is rewritten rather than patched in place, as its later checkpoints change too
+    DataOrder stored_order = *found;
+    *found = DataOrder(order);
+    write_chunk(conf, order.symbol, filename.second, header, book, orders);
+
+    if (conf->get_or_create_index(order.symbol)->exists_higher(order.epoch))
         reconfig_difference(conf, order, stored_order);
 
     return true;
-}
\ No newline at end of file
+}
+
+// Updates are handed to a backfill pass as edits, which nets the differences of all of them
+// into one shift of the later base states
+size_t PUpdate::update_orders(std::vector<Order> &orders)
+{
+    std::unordered_map<std::string, std::vector<Order>> symbols;
+    for (Order &order : orders)
+        symbols[order.symbol].push_back(order);
+
+    size_t updated = 0;
+    for (auto &symbol : symbols)
+    {
+        std::vector<Order> &symbol_orders = symbol.second;
+        std::stable_sort(symbol_orders.begin(), symbol_orders.end(), [](const Order &a, const Order &b)
+                         { return a.epoch < b.epoch; });
+
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol.first));
+        if (conf->memtable_orders)
+            conf->buffer.flush(symbol.first);
+
+        EpochIndexer *idx = conf->get_or_create_index(symbol.first);
+        SymbolBackfill backfill(conf, symbol.first);
+        for (Order &order : symbol_orders)
+        {
+            if (!idx->find(generate_epoch_window(conf, order.epoch)))
+                continue;
+
+            DataOrder changed(order);
+            backfill.edit(ChunkEdit{changed, changed, false});
+        }
+
+        backfill.finish();
+        updated += backfill.edited;
+    }
+
+    return updated;
+}
@@ -0,0 +1,398 @@
+#include "segment.hpp"
+#include "include/config.hpp"
+#include "shared.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SegmentMapping::SegmentMapping(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        void *mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            mapping = mapped;
+            length = file_stat.st_size;
+        }
+    }
+
+    ::close(fd);
+}
+
+SegmentMapping::~SegmentMapping()
+{
+    if (mapping)
+        munmap(mapping, length);
+}
+
+std::string segment_file_name(const std::string &symbol_dir, uint64_t segment)
+{
+    return symbol_dir + std::to_string(segment) + SEGMENT;
+}
+
+bool read_segment_table(const std::string &filename, std::vector<SegmentEntry> &table)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    SegmentHeader header;
+    struct stat file_stat;
+    bool is_read = fstat(fd, &file_stat) == 0 &&
+                   pread(fd, &header, sizeof(SegmentHeader), 0) == sizeof(SegmentHeader) &&
+                   header.magic == SEGMENT_MAGIC &&
+                   header.version == SEGMENT_VERSION &&
+                   header.table_offset <= (uint64_t)file_stat.st_size &&
+                   header.table_count <= (file_stat.st_size - header.table_offset) / sizeof(SegmentEntry);
+
+    if (is_read)
+    {
+        size_t bytes = header.table_count * sizeof(SegmentEntry);
+        table.resize(header.table_count);
+        is_read = pread(fd, table.data(), bytes, header.table_offset) == (ssize_t)bytes;
+    }
+
+    ::close(fd);
+    return is_read;
+}
+
+static std::string symbol_dir(Config *conf, const std::string &symbol)
+{
+    return conf->data_dir + symbol + "/";
+}
+
+// Whether every diff of the window's keyframe group was taken against the current base file of
+// its keyframe. Packing a keyframe drops its previous base file, which the other diffs are still
+// read through until they are re-encoded
+static bool is_group_current(Config *conf, std::string &symbol, uint64_t file_epoch)
+{
+    unsigned int windows = conf->keyframe_windows(symbol);
+    if (windows <= 1)
+        return true;
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    uint64_t group = keyframe_group(conf, symbol, file_epoch);
+    uint64_t group_end = group + windows * conf->epoch_window;
+    for (uint64_t epoch = idx->ceiling(group); epoch != AVL_EMPTY_NODE && epoch < group_end; epoch = idx->successor(epoch))
+    {
+        Header header;
+        Header keyframe;
+        if (!read_chunk_header(conf, symbol, epoch, header))
+            return false;
+        if (header.base_ref != NO_BASE_REF &&
+            (!read_chunk_header(conf, symbol, header.base_ref, keyframe) || keyframe.base_stamp != header.ref_stamp))
+            return false;
+    }
+
+    return true;
+}
+
+Segments::Segments(Config *conf) : conf(conf) {}
+
+// Segments only grow until they are rewritten, so a mapping covers every chunk up to its length
+std::shared_ptr<const SegmentMapping> Segments::mapping(const std::string &symbol, uint64_t segment, uint64_t end)
+{
+    std::shared_ptr<const SegmentMapping> &mapped = mappings[{symbol, segment}];
+    if (!mapped || mapped->size() < end)
+    {
+        std::shared_ptr<const SegmentMapping> remapped = std::make_shared<SegmentMapping>(segment_file_name(symbol_dir(conf, symbol), segment));
+        if (remapped->size() < end)
+            return nullptr;
+
+        mapped = remapped;
+    }
+
+    return mapped;
+}
+
+bool Segments::open(const std::string &symbol, uint64_t window, PackedChunk &packed)
+{
+    // most chunks aren't packed, which is found out without the segment mutex
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    if (!idx->locate(window, packed.location))
+        return false;
+
+    std::lock_guard<std::mutex> guard(segment_mutex);
+    if (!idx->locate(window, packed.location))
+        return false;
+
+    packed.segment = mapping(symbol, packed.location.segment, packed.location.end());
+    return packed.segment != nullptr;
+}
+
+// Appends the table after everything in the segment, then points the header to it. A segment
+// left with nothing in it is removed
+bool Segments::write_table(const std::string &symbol, uint64_t segment, const std::vector<SegmentEntry> &table)
+{
+    std::string filename = segment_file_name(symbol_dir(conf, symbol), segment);
+    if (table.empty())
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex);
+        mappings.erase({symbol, segment});
+        return std::remove(filename.c_str()) == 0;
+    }
+
+    int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat;
+    bool is_written = fstat(fd, &file_stat) == 0;
+    if (is_written)
+    {
+        SegmentHeader header{SEGMENT_MAGIC, SEGMENT_VERSION, segment_align(file_stat.st_size), table.size()};
+        is_written = write_fully(fd, (const char *)table.data(), table.size() * sizeof(SegmentEntry), header.table_offset) &&
+                     write_fully(fd, (const char *)&header, sizeof(SegmentHeader), 0);
+    }
+
+    ::close(fd);
+    return is_written;
+}
+
+// Rewrites the segment with only the chunks still packed into it, once most of it is taken by
+// chunks that were unpacked or dropped since, and by the tables written before the last one
+bool Segments::compact(const std::string &symbol, uint64_t segment)
+{
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    std::string filename = segment_file_name(symbol_dir(conf, symbol), segment);
+    std::vector<SegmentEntry> table = idx->segment_table(segment);
+
+    struct stat file_stat;
+    if (table.empty() || stat(filename.c_str(), &file_stat) != 0)
+        return true;
+
+    uint64_t used = sizeof(SegmentHeader) + table.size() * sizeof(SegmentEntry);
+    for (const SegmentEntry &entry : table)
+        used += entry.location.end() - entry.location.offset;
+    if ((uint64_t)file_stat.st_size - std::min((uint64_t)file_stat.st_size, used) <= used)
+        return true;
+
+    SegmentMapping source(filename);
+    std::string tmp_name = temp_chunk_name(filename);
+    int fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+
+    bool is_written = true;
+    uint64_t offset = sizeof(SegmentHeader);
+    for (SegmentEntry &entry : table)
+    {
+        uint64_t length = entry.location.end() - entry.location.offset;
+        is_written = is_written && entry.location.end() <= source.size() &&
+                     write_fully(fd, source.data() + entry.location.offset, length, offset);
+        entry.location.offset = offset;
+        offset += length;
+    }
+
+    SegmentHeader header{SEGMENT_MAGIC, SEGMENT_VERSION, offset, table.size()};
+    is_written = is_written &&
+                 write_fully(fd, (const char *)table.data(), table.size() * sizeof(SegmentEntry), offset) &&
+                 write_fully(fd, (const char *)&header, sizeof(SegmentHeader), 0);
+    ::close(fd);
+
+    // swapped in under the segment mutex, so that readers only ever map it along with the new offsets
+    std::lock_guard<std::mutex> guard(segment_mutex);
+    if (!is_written || std::rename(tmp_name.c_str(), filename.c_str()) != 0)
+    {
+        ::unlink(tmp_name.c_str());
+        return false;
+    }
+
+    mappings.erase({symbol, segment});
+    for (const SegmentEntry &entry : table)
+        idx->place(entry.window, entry.location);
+
+    return true;
+}
+
+// Copies the chunks' files after everything in the segment, with the table that adds them, and
+// only then locates them there and removes their files. A segment cut off before its header was
+// written still reads as before, and the chunks' own files are still there
+bool Segments::append(const std::string &symbol, uint64_t segment, const std::vector<uint64_t> &windows)
+{
+    static thread_local std::vector<char> buffer;
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    std::string filename = segment_file_name(symbol_dir(conf, symbol), segment);
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT, 0666);
+    if (fd < 0)
+        return false;
+
+    // a new segment starts right after its header, which is only written along with its first table
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    uint64_t end = std::max((uint64_t)sizeof(SegmentHeader), segment_align(file_stat.st_size));
+
+    buffer.clear();
+    std::vector<SegmentEntry> packed;
+    for (uint64_t window : windows)
+    {
+        std::string chunk_name = generate_filename(conf, window, symbol).first;
+        std::shared_ptr<ChunkReader> reader = conf->chunks.open(chunk_name, conf->tick_size(symbol));
+        if (!reader->valid())
+            continue;
+
+        SegmentMapping orders(chunk_name);
+        SegmentMapping base(base_file_name(chunk_name, reader->header().base_stamp));
+        if (orders.size() < reader->data_length() || base.size() == 0)
+            continue;
+
+        SegmentEntry entry;
+        entry.window = window;
+        entry.location = {segment, end + buffer.size(), reader->data_length(), base.size()};
+        buffer.insert(buffer.end(), orders.data(), orders.data() + entry.location.orders_length);
+        buffer.resize(segment_align(buffer.size()));
+        buffer.insert(buffer.end(), base.data(), base.data() + entry.location.base_length);
+        buffer.resize(segment_align(buffer.size()));
+        packed.push_back(entry);
+    }
+
+    bool is_written = !packed.empty() && write_fully(fd, buffer.data(), buffer.size(), end);
+    ::close(fd);
+    if (!is_written)
+        return false;
+
+    std::vector<SegmentEntry> table = idx->segment_table(segment);
+    table.insert(table.end(), packed.begin(), packed.end());
+    std::sort(table.begin(), table.end(), [](const SegmentEntry &a, const SegmentEntry &b)
+              { return a.window < b.window; });
+    if (!write_table(symbol, segment, table))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex);
+        for (const SegmentEntry &entry : packed)
+            idx->place(entry.window, entry.location);
+    }
+
+    for (const SegmentEntry &entry : packed)
+    {
+        std::string chunk_name = generate_filename(conf, entry.window, symbol).first;
+        conf->chunks.invalidate(chunk_name);
+        std::remove(chunk_name.c_str());
+        std::remove(base_file_name(chunk_name, 0).c_str());
+        std::remove(base_file_name(chunk_name, 1).c_str());
+    }
+
+    return compact(symbol, segment);
+}
+
+// The chunk's files are written before it stops being located in the segment, and the segment's
+// table only drops it after that, so a chunk cut off in between is read from its files
+bool Segments::unpack(const std::string &symbol, uint64_t window)
+{
+    static thread_local std::vector<char> buffer;
+
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    PackedChunk packed;
+    if (!idx->locate(window, packed.location))
+        return true;
+    if (!open(symbol, window, packed))
+        return false;
+
+    const ChunkLocation &location = packed.location;
+    const char *record = packed.segment->data() + location.offset;
+    Header header;
+    if (!parse_chunk_header(record, location.orders_length, header))
+        return false;
+
+    // the base file goes first, as the orders file points readers to it
+    std::string filename = generate_filename(conf, window, symbol).first;
+    const char *base = packed.segment->data() + location.base_offset();
+    buffer.assign(base, base + location.base_length);
+    if (!write_chunk_file(base_file_name(filename, header.base_stamp), buffer))
+        return false;
+
+    buffer.assign(record, record + location.orders_length);
+    if (!write_chunk_file(filename, buffer))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex);
+        idx->unplace(window);
+    }
+
+    conf->chunks.invalidate(filename);
+    return write_table(symbol, location.segment, idx->segment_table(location.segment)) && compact(symbol, location.segment);
+}
+
+void Segments::drop(const std::string &symbol, uint64_t window)
+{
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    ChunkLocation location;
+    if (!idx->locate(window, location))
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(segment_mutex);
+        idx->unplace(window);
+    }
+
+    if (write_table(symbol, location.segment, idx->segment_table(location.segment)))
+        compact(symbol, location.segment);
+}
+
+void Segments::pack(const std::string &symbol)
+{
+    if (!conf->segment_windows)
+        return;
+
+    // the last chunk is the one orders are still appended to
+    std::string name = symbol;
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    std::vector<uint64_t> epochs = idx->epoch_list();
+    if (epochs.size() < 2)
+        return;
+    epochs.pop_back();
+
+    uint64_t span = conf->segment_windows * conf->epoch_window;
+    std::map<uint64_t, std::vector<uint64_t>> segments;
+    std::map<uint64_t, bool> current_groups;
+    for (uint64_t epoch : epochs)
+    {
+        ChunkLocation location;
+        Header header;
+        if (idx->locate(epoch, location) || !read_chunk_header(generate_filename(conf, epoch, symbol).first, header) ||
+            header.version != CHUNK_VERSION)
+            continue;
+
+        uint64_t group = keyframe_group(conf, name, epoch);
+        auto current = current_groups.find(group);
+        if (current == current_groups.end())
+            current = current_groups.emplace(group, is_group_current(conf, name, epoch)).first;
+        if (current->second)
+            segments[(epoch / span) * span].push_back(epoch);
+    }
+
+    for (auto &segment : segments)
+        append(symbol, segment.first, segment.second);
+}
+
+void Segments::pack_all()
+{
+    std::vector<std::string> symbols;
+    {
+        std::lock_guard<std::mutex> guard(conf->registry_mutex);
+        for (auto &entry : conf->indexes)
+            symbols.push_back(entry.first);
+    }
+
+    for (std::string &symbol : symbols)
+    {
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+        pack(symbol);
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef Segment_HPP
+#define Segment_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Config;
+
+static const std::string SEGMENT = "_SEG.dat";
+static const uint32_t SEGMENT_MAGIC = 0x4D474553; // "SEGM"
+static const uint32_t SEGMENT_VERSION = 1;
+
+inline uint64_t segment_align(uint64_t length)
+{
+    return (length + 7) & ~(uint64_t)7;
+}
+
+// Start of a segment file. Chunks and a new offset table are only ever appended after what is
+// there, and the header is switched over to the new table last, so a segment cut off in the
+// middle of an append still reads as before it
+struct SegmentHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t table_offset;
+    uint64_t table_count;
+};
+
+// Where the index finds a chunk packed into a segment: the segment by its first window, then the
+// chunk's orders file up to its last order, followed by the base file its header points to.
+// Both parts start 8 byte aligned, so columns and levels are read in place
+struct ChunkLocation
+{
+    uint64_t segment;
+    uint64_t offset;
+    uint64_t orders_length;
+    uint64_t base_length;
+
+    inline uint64_t base_offset() const { return offset + segment_align(orders_length); }
+    inline uint64_t end() const { return base_offset() + segment_align(base_length); }
+};
+
+// Entry of a segment's offset table, which is sorted by window
+struct SegmentEntry
+{
+    uint64_t window;
+    ChunkLocation location;
+};
+
+// Read-only mapping of a whole segment file, shared by every chunk read from it (chunk files are
+// mapped the same way while they are copied into a segment)
+class SegmentMapping
+{
+    void *mapping = nullptr;
+    size_t length = 0;
+
+public:
+    SegmentMapping(const std::string &filename);
+    ~SegmentMapping();
+
+    SegmentMapping(const SegmentMapping &) = delete;
+    SegmentMapping &operator=(const SegmentMapping &) = delete;
+
+    inline const char *data() const { return (const char *)mapping; }
+    inline size_t size() const { return length; }
+};
+
+// A packed chunk: the mapping of its segment, which outlives any reader of the chunk, and where
+// the chunk is in it
+struct PackedChunk
+{
+    std::shared_ptr<const SegmentMapping> segment;
+    ChunkLocation location;
+};
+
+std::string segment_file_name(const std::string &symbol_dir, uint64_t segment);
+
+// Offset table of a segment file. False if it is missing or damaged
+bool read_segment_table(const std::string &filename, std::vector<SegmentEntry> &table);
+
+// Segment files of every symbol. With Config::segment_windows set, pack moves the chunks of a
+// symbol that are done being appended to out of their own files, and into one append-only file
+// per that many windows, so that a single mapping covers all of them. Packed chunks are only
+// read in place: any write to one first unpacks it back into files of its own, and the next
+// pack appends it to its segment again, which is rewritten once most of it is left unused
+class Segments
+{
+    Config *conf;
+    // held while locations change and while chunks are looked up, so that a reader never gets a
+    // location together with the mapping of a segment it isn't in
+    std::mutex segment_mutex;
+    std::map<std::pair<std::string, uint64_t>, std::shared_ptr<const SegmentMapping>> mappings;
+
+    std::shared_ptr<const SegmentMapping> mapping(const std::string &symbol, uint64_t segment, uint64_t end);
+    bool append(const std::string &symbol, uint64_t segment, const std::vector<uint64_t> &windows);
+    bool write_table(const std::string &symbol, uint64_t segment, const std::vector<SegmentEntry> &table);
+    bool compact(const std::string &symbol, uint64_t segment);
+
+public:
+    Segments(Config *conf);
+
+    Segments(const Segments &) = delete;
+    Segments &operator=(const Segments &) = delete;
+
+    // false if the chunk is in files of its own
+    bool open(const std::string &symbol, uint64_t window, PackedChunk &packed);
+
+    // writes a packed chunk back into files of its own, byte for byte, and forgets where it was
+    // packed. True if it is in files of its own from then on. The symbol's lock has to be held
+    bool unpack(const std::string &symbol, uint64_t window);
+
+    // forgets where a chunk that is being removed was packed, with the symbol's lock held
+    void drop(const std::string &symbol, uint64_t window);
+
+    // packs every chunk of the symbol in files of its own, but its last one, into the segments
+    // their windows fall in. The symbol's lock has to be held by the caller
+    void pack(const std::string &symbol);
+    void pack_all();
+};
+
+#endif
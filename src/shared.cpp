@@ -1,5 +1,8 @@
 #include "shared.hpp"
 #include "include/config.hpp"
+#include <atomic>
+#include <set>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -26,23 +29,769 @@ std::pair<std::string, uint64_t> generate_filename(Config *conf, uint64_t epoch,
 	return {filename, timestamp_from};
 }
 
-void write_header(std::ofstream &fout, Header &header)
+// Whether a checkpoint has to be taken, given the orders and nanoseconds since the last one
+// (or since the first order of the chunk)
+bool checkpoint_due(Config *conf, unsigned long orders_since, uint64_t nanos_since)
 {
-	fout.write((char *)&header, sizeof(Header));
+	return (conf->checkpoint_orders && orders_since >= conf->checkpoint_orders) ||
+		   (conf->checkpoint_nanos && nanos_since >= conf->checkpoint_nanos);
 }
 
-void write_base_book(std::ofstream &fout, OrderBook &book)
+void CheckpointTable::clear()
 {
-	std::vector<OrderEntry> buys = book.buy_list();
-	std::vector<OrderEntry> sells = book.sell_list();
+	entries.clear();
+	levels.clear();
+	start_epoch = 0;
+}
+
+// Called after every replayed order, takes a snapshot of the book when one is due
+void CheckpointTable::track(Config *conf, OrderBook &book, unsigned long order_count, uint64_t epoch, Header &trades)
+{
+	if (order_count == 1)
+		start_epoch = epoch;
+
+	unsigned long last_count = entries.empty() ? 0 : entries.back().order_count;
+	uint64_t last_epoch = entries.empty() ? start_epoch : entries.back().epoch;
+
+	if (!checkpoint_due(conf, order_count - last_count, epoch - last_epoch))
+		return;
+
+	const std::vector<OrderEntry> &buys = book.buy_levels.entries();
+	const std::vector<OrderEntry> &sells = book.sell_levels.entries();
+	levels.insert(levels.end(), buys.begin(), buys.end());
+	levels.insert(levels.end(), sells.begin(), sells.end());
+
+	Checkpoint checkpoint;
+	checkpoint.order_count = order_count;
+	checkpoint.epoch = epoch;
+	checkpoint.book_buy = buys.size();
+	checkpoint.book_sell = sells.size();
+	checkpoint.last_trade_qty = trades.last_trade_qty;
+	checkpoint.last_trade_price = trades.last_trade_price;
+	checkpoint.last_trade_epoch = trades.last_trade_epoch;
+	entries.push_back(checkpoint);
+}
+
+// Applies a stored order to the book, keeping track of the last trade in the header
+void replay_order(OrderBook &book, Header &trades, DataOrder &stored_order, std::string &symbol)
+{
+	if (stored_order.category == TRADE)
+	{
+		trades.last_trade_epoch = stored_order.epoch;
+		trades.last_trade_qty = stored_order.qty;
+		trades.last_trade_price = stored_order.price;
+	}
+
+	Order order(symbol, stored_order.epoch, stored_order.id, stored_order.side,
+				stored_order.category, stored_order.qty, stored_order.price);
+
+	book.add(order);
+}
+
+std::shared_ptr<ChunkReader> open_chunk(Config *conf, const std::string &symbol, uint64_t file_epoch)
+{
+	PackedChunk packed;
+	if (conf->segments.open(symbol, file_epoch, packed))
+		return std::make_shared<ChunkReader>(packed);
+
+	// packing removes the chunk's files right after locating it in its segment
+	std::shared_ptr<ChunkReader> reader = conf->chunks.open(generate_filename(conf, file_epoch, symbol).first, conf->tick_size(symbol));
+	if (!reader->valid() && conf->segments.open(symbol, file_epoch, packed))
+		return std::make_shared<ChunkReader>(packed);
+
+	return reader;
+}
+
+bool read_chunk_header(Config *conf, const std::string &symbol, uint64_t file_epoch, Header &header)
+{
+	PackedChunk packed;
+	if (conf->segments.open(symbol, file_epoch, packed))
+		return parse_chunk_header(packed.segment->data() + packed.location.offset, packed.location.orders_length, header);
+
+	return read_chunk_header(generate_filename(conf, file_epoch, symbol).first, header);
+}
+
+bool read_keyframe(Config *conf, const std::string &symbol, uint64_t file_epoch, uint64_t base_stamp, OrderBook &book)
+{
+	PackedChunk packed;
+	if (conf->segments.open(symbol, file_epoch, packed) &&
+		read_keyframe(packed.segment->data() + packed.location.base_offset(), packed.location.base_length, base_stamp, book))
+		return true;
+
+	return read_keyframe(generate_filename(conf, file_epoch, symbol).first, base_stamp, book);
+}
+
+// Decoded form of a chunk that was just written or changed in memory
+static std::shared_ptr<DecodedChunk> decoded_chunk(const Header &header,
+												   const OrderBook &base,
+												   const CheckpointTable &checkpoints,
+												   const std::vector<DataOrder> &orders)
+{
+	std::shared_ptr<DecodedChunk> chunk = std::make_shared<DecodedChunk>();
+	chunk->header = header;
+	chunk->base = base;
+	chunk->checkpoints = checkpoints.entries;
+	chunk->checkpoint_levels = checkpoints.levels;
+	chunk->orders = orders;
+
+	// the header may describe a diff, while decoded chunks always hold the whole base state
+	chunk->header.base_buy = base.buy_levels.size();
+	chunk->header.base_sell = base.sell_levels.size();
+	chunk->header.base_ref = NO_BASE_REF;
+
+	size_t offset = 0;
+	for (const Checkpoint &checkpoint : checkpoints.entries)
+	{
+		chunk->checkpoint_offsets.push_back(offset);
+		offset += checkpoint.book_buy + checkpoint.book_sell;
+	}
+
+	return chunk;
+}
+
+// Copy of the chunk with the shift applied to its base state. Its checkpoints are replayed again
+// from there, like when the chunk is rewritten, as levels that ran empty would differ otherwise
+static std::shared_ptr<const DecodedChunk> shift_chunk(Config *conf, const DecodedChunk &chunk, BaseShift &shift, uint64_t delta_seq)
+{
+	Header header = chunk.header;
+	header.delta_seq = delta_seq;
+	OrderBook base = chunk.base;
+	std::vector<DataOrder> orders = chunk.orders;
+	shift.apply(header, base);
+
+	CheckpointTable checkpoints;
+	build_checkpoints(conf, header, base, orders, checkpoints);
+	return decoded_chunk(header, base, checkpoints, orders);
+}
+
+// Rebuilds the whole base state of a decoded chunk that stores a diff against its keyframe.
+// False if the keyframe's base file was replaced since, which only happens to readers that
+// mapped the chunk before it was re-encoded
+static bool decode_base(Config *conf, std::string &symbol, const ChunkReader &reader, DecodedChunk &chunk)
+{
+	const Header &header = reader.header();
+	if (header.base_ref == NO_BASE_REF)
+		return true;
+
+	if (!read_keyframe(conf, symbol, header.base_ref, header.ref_stamp, chunk.base))
+		return false;
+
+	patch_book(chunk.base, reader.base_buy(), reader.base_sell());
+	chunk.header.base_buy = chunk.base.buy_levels.size();
+	chunk.header.base_sell = chunk.base.sell_levels.size();
+	chunk.header.base_ref = NO_BASE_REF;
+	return true;
+}
+
+// Decoded chunk from the cache, or decoded from its mapping and cached on a miss.
+// Changes of the delta log the chunk doesn't carry yet are folded into it, and the folded copy
+// replaces the cached one. nullptr if the chunk file is missing or damaged
+std::shared_ptr<const DecodedChunk> load_chunk(Config *conf, std::string symbol, uint64_t file_epoch)
+{
+	DeltaLog &symbol_log = conf->deltas.log(symbol);
+	std::string filename = generate_filename(conf, file_epoch, symbol).first;
+
+	// a chunk read before the log was trimmed may lack changes the log no longer has. It was
+	// rewritten with them before the trim, so it is read again
+	while (true)
+	{
+		uint64_t trims = symbol_log.trims();
+		std::shared_ptr<const DecodedChunk> chunk = conf->decoded.get(symbol, file_epoch);
+		bool is_cached = chunk != nullptr;
+		if (!is_cached)
+		{
+			std::shared_ptr<DecodedChunk> decoded;
+			for (int attempt = 0; attempt < MAP_ATTEMPTS && !decoded; attempt++)
+			{
+				std::shared_ptr<ChunkReader> reader = open_chunk(conf, symbol, file_epoch);
+				if (!reader->valid())
+					return nullptr;
+
+				decoded = std::make_shared<DecodedChunk>(*reader);
+				if (!decode_base(conf, symbol, *reader, *decoded))
+				{
+					decoded = nullptr;
+					conf->chunks.invalidate(filename);
+				}
+			}
+
+			if (!decoded)
+				return nullptr;
+
+			chunk = decoded;
+		}
+
+		BaseShift shift;
+		uint64_t delta_seq = symbol_log.collect(file_epoch, chunk->header.delta_seq, shift);
+		if (symbol_log.trims() != trims)
+			continue;
+
+		if (!shift.empty())
+			chunk = shift_chunk(conf, *chunk, shift, delta_seq);
+		else if (is_cached)
+			return chunk;
+
+		// cached unless the log was trimmed in the meantime, as the trim only drops what was
+		// cached before it
+		symbol_log.unless_trimmed(trims, [&]()
+								  { conf->decoded.put(symbol, file_epoch, chunk); });
+		return chunk;
+	}
+}
+
+// Copies the header, base state and all orders of a chunk (checkpoints are skipped)
+bool read_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, std::vector<DataOrder> &orders)
+{
+	std::shared_ptr<const DecodedChunk> chunk = load_chunk(conf, symbol, file_epoch);
+	if (!chunk)
+		return false;
+
+	header = chunk->header;
+	base = chunk->base;
+	orders = chunk->orders;
+	return true;
+}
+
+void build_checkpoints(Config *conf, Header header, OrderBook book, std::vector<DataOrder> &orders, CheckpointTable &checkpoints)
+{
+	std::string symbol;
+	checkpoints.clear();
+
+	for (unsigned long j = 0; j < orders.size(); j++)
+	{
+		replay_order(book, header, orders[j], symbol);
+		checkpoints.track(conf, book, j + 1, orders[j].epoch, header);
+	}
+}
+
+// Fills in the format and section sizes of a chunk's header before it is written
+void prepare_header(Config *conf, std::string &symbol, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders)
+{
+	// chunks are always rewritten in the current format, which migrates version 0 chunks
+	header.magic = CHUNK_MAGIC;
+	header.version = CHUNK_VERSION;
+	header.tick_size = conf->tick_size(symbol);
+	header.base_buy = base.buy_levels.size();
+	header.base_sell = base.sell_levels.size();
+	header.update_size = orders.size();
+	header.checkpoints = checkpoints.entries.size();
+
+	// the base state has every logged change folded in, as it was read through load_chunk
+	header.delta_seq = conf->deltas.log(symbol).sequence();
+}
+
+uint64_t keyframe_group(Config *conf, std::string &symbol, uint64_t epoch)
+{
+	uint64_t span = conf->epoch_window * conf->keyframe_windows(symbol);
+	return (epoch / span) * span;
+}
+
+bool find_keyframe(Config *conf, std::string &symbol, uint64_t file_epoch, Keyframe &keyframe, uint64_t removed)
+{
+	if (conf->keyframe_windows(symbol) <= 1)
+		return false;
+
+	EpochIndexer *idx = conf->get_or_create_index(symbol);
+	uint64_t group = keyframe_group(conf, symbol, file_epoch);
+	uint64_t first = idx->ceiling(group);
+	if (first == removed)
+		first = idx->successor(first);
+	if (first == AVL_EMPTY_NODE || first >= file_epoch)
+		return false;
+
+	Header header;
+	if (!read_chunk_header(conf, symbol, first, header) || header.version < KEYFRAME_VERSION || header.base_ref != NO_BASE_REF ||
+		!read_keyframe(conf, symbol, first, header.base_stamp, keyframe.base))
+		return false;
+
+	keyframe.epoch = first;
+	keyframe.stamp = header.base_stamp;
+	return true;
+}
+
+// Levels of to that differ from the ones of from, with a quantity of 0 for the levels to lacks.
+// Both sides are sorted from the worst price to the best one, and so is the diff
+static void diff_levels(const std::vector<OrderEntry> &from, const std::vector<OrderEntry> &to, bool is_buy, std::vector<OrderEntry> &diff)
+{
+	auto worse = [is_buy](Price a, Price b)
+	{ return is_buy ? a < b : a > b; };
+
+	diff.clear();
+	size_t i = 0, j = 0;
+	while (i < from.size() || j < to.size())
+	{
+		if (j == to.size() || (i < from.size() && worse(from[i].price, to[j].price)))
+			diff.push_back(OrderEntry(0, from[i++].price));
+		else if (i == from.size() || worse(to[j].price, from[i].price))
+			diff.push_back(to[j++]);
+		else
+		{
+			if (from[i].qty != to[j].qty)
+				diff.push_back(to[j]);
+			i++;
+			j++;
+		}
+	}
+}
+
+void encode_base(Header &header, const OrderBook &base, const Keyframe *keyframe, StoredBase &stored)
+{
+	const std::vector<OrderEntry> &buys = base.buy_levels.entries();
+	const std::vector<OrderEntry> &sells = base.sell_levels.entries();
+	stored.buys = &buys;
+	stored.sells = &sells;
+	header.base_ref = NO_BASE_REF;
+	header.ref_stamp = 0;
+
+	if (keyframe)
+	{
+		diff_levels(keyframe->base.buy_levels.entries(), buys, true, stored.buy_diff);
+		diff_levels(keyframe->base.sell_levels.entries(), sells, false, stored.sell_diff);
+		if (stored.buy_diff.size() + stored.sell_diff.size() < buys.size() + sells.size())
+		{
+			stored.buys = &stored.buy_diff;
+			stored.sells = &stored.sell_diff;
+			header.base_ref = keyframe->epoch;
+			header.ref_stamp = keyframe->stamp;
+		}
+	}
+
+	header.base_buy = stored.buys->size();
+	header.base_sell = stored.sells->size();
+}
+
+// Stores the base state of a chunk that is written with the same checkpoints again against the
+// current keyframe of its group, leaving its orders and delta sequence as they are
+static bool reencode_base(Config *conf, std::string &symbol, uint64_t file_epoch, uint64_t removed)
+{
+	static thread_local std::vector<char> buffer;
+
+	std::string filename = generate_filename(conf, file_epoch, symbol).first;
+	if (!conf->segments.unpack(symbol, file_epoch))
+		return false;
+
+	std::shared_ptr<ChunkReader> reader = conf->chunks.open(filename, conf->tick_size(symbol));
+	if (!reader->valid())
+		return false;
+
+	Header header = reader->header();
+	OrderBook base;
+	if (header.base_ref == NO_BASE_REF)
+		reader->base_book(base);
+	else if (read_keyframe(conf, symbol, header.base_ref, header.ref_stamp, base))
+		patch_book(base, reader->base_buy(), reader->base_sell());
+	else
+		return false;
+
+	Span<Checkpoint> table = reader->checkpoints();
+	std::vector<Checkpoint> checkpoints(table.begin(), table.end());
+	std::vector<OrderEntry> levels;
+	for (size_t idx = 0; idx < table.size(); idx++)
+	{
+		Span<OrderEntry> buys = reader->checkpoint_buy(idx);
+		Span<OrderEntry> sells = reader->checkpoint_sell(idx);
+		levels.insert(levels.end(), buys.begin(), buys.end());
+		levels.insert(levels.end(), sells.begin(), sells.end());
+	}
 
-	for (OrderEntry &entry : buys)
+	// chunks in an older format get a new orders file as well, as their header is shorter
+	std::vector<DataOrder> orders;
+	bool has_orders = header.version != CHUNK_VERSION;
+	if (has_orders && !reader->read_orders(orders))
+		return false;
+	header.version = CHUNK_VERSION;
+
+	Keyframe keyframe;
+	StoredBase stored;
+	encode_base(header, base, find_keyframe(conf, symbol, file_epoch, keyframe, removed) ? &keyframe : nullptr, stored);
+	bool is_written = write_base_file(filename, header, *stored.buys, *stored.sells, checkpoints, levels, buffer);
+	if (is_written && has_orders)
 	{
-		fout.write((char *)&entry, sizeof(OrderEntry));
+		serialize_orders(buffer, header, orders, conf->order_layout);
+		is_written = write_chunk_file(filename, buffer);
+		conf->decoded.invalidate(symbol, file_epoch);
 	}
+	else if (is_written)
+		is_written = patch_header(filename, header);
+
+	conf->chunks.invalidate(filename);
+	return is_written;
+}
+
+// Re-encodes the diffs of the window's keyframe group whose keyframe was rewritten since they were
+// taken, or is being removed. Until the keyframe's next rewrite, its previous base file is still
+// there to read them through, so this runs both before and after base files are written.
+// The removed chunk is left out of the group, and its files have to still be there
+static void refresh_keyframe_group(Config *conf, std::string &symbol, uint64_t file_epoch, uint64_t removed = NO_BASE_REF)
+{
+	unsigned int windows = conf->keyframe_windows(symbol);
+	if (windows <= 1)
+		return;
+
+	EpochIndexer *idx = conf->get_or_create_index(symbol);
+	uint64_t group = keyframe_group(conf, symbol, file_epoch);
+	uint64_t group_end = group + windows * conf->epoch_window;
+
+	// the chunk being written may not be indexed yet
+	std::vector<uint64_t> members;
+	for (uint64_t epoch = idx->ceiling(group); epoch != AVL_EMPTY_NODE && epoch < group_end; epoch = idx->successor(epoch))
+		if (epoch != removed)
+			members.push_back(epoch);
+	if (file_epoch != removed && !std::binary_search(members.begin(), members.end(), file_epoch))
+		members.insert(std::upper_bound(members.begin(), members.end(), file_epoch), file_epoch);
+
+	// keyframes come first in their group, so the ones re-encoded here are checked before their diffs
+	for (size_t i = 0; i < members.size(); i++)
+	{
+		Header header;
+		if (!read_chunk_header(conf, symbol, members[i], header) || header.base_ref == NO_BASE_REF)
+			continue;
+
+		Header keyframe;
+		bool is_current = std::find(members.begin(), members.begin() + i, header.base_ref) != members.begin() + i &&
+						  read_chunk_header(conf, symbol, header.base_ref, keyframe) &&
+						  keyframe.base_stamp == header.ref_stamp;
+		if (!is_current)
+			reencode_base(conf, symbol, members[i], removed);
+	}
+}
+
+// Base file of a chunk, stored against the keyframe of its group
+static bool write_encoded_base(Config *conf, std::string &symbol, uint64_t file_epoch, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<char> &buffer)
+{
+	static thread_local StoredBase stored;
+
+	Keyframe keyframe;
+	encode_base(header, base, find_keyframe(conf, symbol, file_epoch, keyframe) ? &keyframe : nullptr, stored);
+	return write_base_file(generate_filename(conf, file_epoch, symbol).first, header, *stored.buys, *stored.sells,
+						   checkpoints.entries, checkpoints.levels, buffer);
+}
 
-	for (OrderEntry &entry : sells)
+// Writes a whole chunk: its base file for the next stamp first, then its orders file into a
+// temporary file that is swapped in place of the old one, which switches readers to both at once.
+// Each file is laid out in a per-thread buffer that keeps its capacity, and written in one go.
+// A cached mapping of the old file is dropped, while a cached decoded copy is patched with the new content
+void write_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders)
+{
+	static thread_local std::vector<char> buffer;
+
+	// a packed chunk is written in files of its own
+	std::string filename = generate_filename(conf, file_epoch, symbol).first;
+	if (!conf->segments.unpack(symbol, file_epoch))
+		return;
+
+	prepare_header(conf, symbol, header, base, checkpoints, orders);
+	refresh_keyframe_group(conf, symbol, file_epoch);
+	if (write_encoded_base(conf, symbol, file_epoch, header, base, checkpoints, buffer))
 	{
-		fout.write((char *)&entry, sizeof(OrderEntry));
+		serialize_orders(buffer, header, orders, conf->order_layout);
+		write_chunk_file(filename, buffer);
 	}
-}
\ No newline at end of file
+	conf->chunks.invalidate(filename);
+	refresh_keyframe_group(conf, symbol, file_epoch);
+
+	// decoding is skipped for chunks nobody has read recently, such as freshly ingested ones
+	if (!conf->decoded.peek(symbol, file_epoch))
+		return;
+
+	std::shared_ptr<DecodedChunk> chunk = decoded_chunk(header, base, checkpoints, orders);
+	conf->decoded.patch(symbol, file_epoch, chunk);
+}
+
+void write_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, std::vector<DataOrder> &orders)
+{
+	CheckpointTable checkpoints;
+	build_checkpoints(conf, header, base, orders, checkpoints);
+	write_chunk(conf, symbol, file_epoch, header, base, checkpoints, orders);
+}
+
+bool write_chunk_base(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders)
+{
+	static thread_local std::vector<char> buffer;
+
+	std::string filename = generate_filename(conf, file_epoch, symbol).first;
+	if (!conf->segments.unpack(symbol, file_epoch))
+		return false;
+
+	prepare_header(conf, symbol, header, base, checkpoints, orders);
+	refresh_keyframe_group(conf, symbol, file_epoch);
+	if (!write_encoded_base(conf, symbol, file_epoch, header, base, checkpoints, buffer) ||
+		!patch_header(filename, header))
+		return false;
+
+	conf->chunks.invalidate(filename);
+	refresh_keyframe_group(conf, symbol, file_epoch);
+	if (conf->decoded.peek(symbol, file_epoch))
+		conf->decoded.patch(symbol, file_epoch, decoded_chunk(header, base, checkpoints, orders));
+
+	return true;
+}
+
+void remove_chunk(Config *conf, std::string symbol, uint64_t file_epoch)
+{
+	// diffs against the chunk are re-encoded while it can still be read
+	refresh_keyframe_group(conf, symbol, file_epoch, file_epoch);
+
+	std::string filename = generate_filename(conf, file_epoch, symbol).first;
+	conf->segments.drop(symbol, file_epoch);
+	fs::remove(filename);
+	fs::remove(base_file_name(filename, 0));
+	fs::remove(base_file_name(filename, 1));
+	conf->chunks.invalidate(filename);
+	conf->decoded.invalidate(symbol, file_epoch);
+}
+
+void BaseShift::add(const Order &order)
+{
+	std::map<Price, int64_t> &delta = order.side == BUY ? buy_delta : sell_delta;
+	int64_t change = order.category == NEW ? (int64_t)order.qty : -(int64_t)order.qty;
+
+	// levels that cancel out are dropped, so that they don't touch later chunks at all
+	if ((delta[order.price] += change) == 0)
+		delta.erase(order.price);
+
+	if (order.category == TRADE && (!is_traded || order.epoch >= last_trade_epoch))
+	{
+		last_trade_qty = order.qty;
+		last_trade_price = order.price;
+		last_trade_epoch = order.epoch;
+		is_traded = true;
+	}
+}
+
+void BaseShift::apply(Header &header, OrderBook &base) const
+{
+	for (auto &level : buy_delta)
+		if (level.second > 0)
+			base.buy_levels.add(level.second, level.first);
+		else
+			base.buy_levels.remove(-level.second, level.first);
+
+	for (auto &level : sell_delta)
+		if (level.second > 0)
+			base.sell_levels.add(level.second, level.first);
+		else
+			base.sell_levels.remove(-level.second, level.first);
+
+	if (is_traded && last_trade_epoch > header.last_trade_epoch)
+	{
+		header.last_trade_epoch = last_trade_epoch;
+		header.last_trade_price = last_trade_price;
+		header.last_trade_qty = last_trade_qty;
+	}
+}
+
+// Chunk of a parallel rewrite, written into its temporary file but not swapped in yet
+struct StagedChunk
+{
+	std::string filename;
+	Header header;
+	Header stored_header; // header of the orders file before the shift, put back if the shift is undone
+	bool is_staged = false;
+	bool is_failed = false;
+	bool has_orders = false; // chunks in an older format get a new orders file as well
+	std::shared_ptr<DecodedChunk> decoded; // only kept for chunks that are cached
+};
+
+static void stage_shifted_chunk(Config *conf,
+								std::string &symbol,
+								uint64_t file_epoch,
+								const BaseShift &shift,
+								const Keyframe *keyframe,
+								StagedChunk &staged,
+								std::vector<char> &buffer)
+{
+	Header header;
+	OrderBook base;
+	std::vector<DataOrder> orders;
+	staged.filename = generate_filename(conf, file_epoch, symbol).first;
+	if (!read_chunk(conf, symbol, file_epoch, header, base, orders))
+		return;
+
+	shift.apply(header, base);
+	staged.has_orders = header.version != CHUNK_VERSION;
+	if (!staged.has_orders && !read_chunk_header(staged.filename, staged.stored_header))
+	{
+		staged.is_failed = true;
+		return;
+	}
+
+	// checkpoints are rebuilt as they carry the old base state. The new base file is not the one
+	// readers use, so only the orders file's header has to change when the chunk is committed
+	CheckpointTable checkpoints;
+	build_checkpoints(conf, header, base, orders, checkpoints);
+	prepare_header(conf, symbol, header, base, checkpoints, orders);
+	StoredBase stored;
+	encode_base(header, base, keyframe, stored);
+	staged.is_staged = write_base_file(staged.filename, header, *stored.buys, *stored.sells,
+									   checkpoints.entries, checkpoints.levels, buffer);
+	if (staged.is_staged && staged.has_orders)
+	{
+		serialize_orders(buffer, header, orders, conf->order_layout);
+		staged.is_staged = stage_chunk_file(staged.filename, buffer);
+	}
+
+	staged.header = header;
+	staged.is_failed = !staged.is_staged;
+	if (staged.is_staged && conf->decoded.peek(symbol, file_epoch))
+		staged.decoded = decoded_chunk(header, base, checkpoints, orders);
+}
+
+// Keyframe each chunk is stored against once the shift is in, keyed by group. They are resolved
+// before any chunk is staged, as they are rewritten concurrently: a keyframe that is shifted too
+// is read with the shift applied, under the stamp it is about to get
+static std::vector<const Keyframe *> shifted_keyframes(Config *conf,
+													   std::string &symbol,
+													   const std::vector<uint64_t> &file_epochs,
+													   const BaseShift &shift,
+													   std::map<uint64_t, Keyframe> &keyframes)
+{
+	std::vector<const Keyframe *> found(file_epochs.size(), nullptr);
+	if (conf->keyframe_windows(symbol) <= 1)
+		return found;
+
+	EpochIndexer *idx = conf->get_or_create_index(symbol);
+	std::set<uint64_t> shifted(file_epochs.begin(), file_epochs.end());
+	for (size_t i = 0; i < file_epochs.size(); i++)
+	{
+		uint64_t group = keyframe_group(conf, symbol, file_epochs[i]);
+		auto entry = keyframes.find(group);
+		if (entry == keyframes.end())
+		{
+			entry = keyframes.emplace(group, Keyframe()).first;
+			Keyframe &keyframe = entry->second;
+			uint64_t first = idx->ceiling(group);
+
+			if (!shifted.count(first))
+			{
+				if (!find_keyframe(conf, symbol, file_epochs[i], keyframe))
+					keyframe.epoch = NO_BASE_REF;
+			}
+			else if (std::shared_ptr<const DecodedChunk> chunk = load_chunk(conf, symbol, first))
+			{
+				Header header = chunk->header;
+				keyframe.base = chunk->base;
+				shift.apply(header, keyframe.base);
+				keyframe.epoch = first;
+				keyframe.stamp = current_base_stamp(generate_filename(conf, first, symbol).first) + 1;
+			}
+		}
+
+		if (entry->second.epoch < file_epochs[i])
+			found[i] = &entry->second;
+	}
+
+	return found;
+}
+
+// Refreshes each keyframe group the chunks fall in once
+static void refresh_keyframe_groups(Config *conf, std::string &symbol, const std::vector<uint64_t> &file_epochs)
+{
+	if (conf->keyframe_windows(symbol) <= 1)
+		return;
+
+	uint64_t last_group = NO_BASE_REF;
+	for (uint64_t file_epoch : file_epochs)
+		if (keyframe_group(conf, symbol, file_epoch) != last_group)
+		{
+			last_group = keyframe_group(conf, symbol, file_epoch);
+			refresh_keyframe_group(conf, symbol, file_epoch);
+		}
+}
+
+bool shift_chunks(Config *conf, std::string symbol, const std::vector<uint64_t> &file_epochs, const BaseShift &shift)
+{
+	// the staged base files take their stamps from the chunks' own files
+	for (uint64_t file_epoch : file_epochs)
+		if (!conf->segments.unpack(symbol, file_epoch))
+			return false;
+
+	refresh_keyframe_groups(conf, symbol, file_epochs);
+	std::map<uint64_t, Keyframe> keyframes;
+	std::vector<const Keyframe *> chunk_keyframes = shifted_keyframes(conf, symbol, file_epochs, shift, keyframes);
+
+	unsigned int workers = conf->reconfig_threads ? conf->reconfig_threads : std::thread::hardware_concurrency();
+	workers = std::max(1u, std::min(workers, (unsigned int)file_epochs.size()));
+
+	// chunks are independent of each other, so workers just take the next one that is left
+	std::vector<StagedChunk> staged(file_epochs.size());
+	std::atomic<size_t> next{0};
+	auto run_worker = [&]()
+	{
+		std::vector<char> buffer;
+		for (size_t i = next++; i < file_epochs.size(); i = next++)
+			stage_shifted_chunk(conf, symbol, file_epochs[i], shift, chunk_keyframes[i], staged[i], buffer);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < workers; i++)
+		threads.push_back(std::thread(run_worker));
+
+	run_worker();
+	for (std::thread &thread : threads)
+		thread.join();
+
+	bool is_failed = std::any_of(staged.begin(), staged.end(), [](const StagedChunk &chunk)
+								 { return chunk.is_failed; });
+
+	// nothing is switched over unless every chunk could be written, and the chunks switched over
+	// before one that fails to are switched back, so the symbol is left as it was
+	size_t switched = 0; // chunks before this one were switched over, the last maybe only halfway
+	for (size_t i = 0; !is_failed && i < staged.size(); i++)
+	{
+		StagedChunk &chunk = staged[i];
+		if (!chunk.is_staged)
+			continue;
+
+		switched = i + 1;
+		bool is_committed = chunk.has_orders ? backup_chunk_file(chunk.filename) && commit_chunk_file(chunk.filename)
+											 : patch_header(chunk.filename, chunk.header);
+		conf->chunks.invalidate(chunk.filename);
+		if (!is_committed)
+			is_failed = true;
+	}
+
+	for (size_t i = 0; i < staged.size(); i++)
+	{
+		StagedChunk &chunk = staged[i];
+		if (!chunk.is_staged)
+			continue;
+
+		if (!is_failed)
+		{
+			if (chunk.has_orders)
+				drop_chunk_backup(chunk.filename);
+			if (chunk.decoded)
+				conf->decoded.patch(symbol, file_epochs[i], chunk.decoded);
+			continue;
+		}
+
+		if (i < switched)
+		{
+			if (chunk.has_orders)
+				restore_chunk_file(chunk.filename);
+			else
+				patch_header(chunk.filename, chunk.stored_header);
+			conf->chunks.invalidate(chunk.filename);
+		}
+
+		if (chunk.has_orders)
+			discard_chunk_file(chunk.filename);
+	}
+
+	// chunks left out of the rewrite may be diffs against a keyframe that was part of it
+	refresh_keyframe_groups(conf, symbol, file_epochs);
+	return !is_failed;
+}
+
+void reconfig_ahead(Config *conf, uint64_t epoch, std::string symbol, BaseShift &shift)
+{
+	EpochIndexer *idx = conf->get_or_create_index(symbol);
+
+	std::vector<uint64_t> file_epochs;
+	uint64_t file_epoch = idx->successor(generate_epoch_window(conf, epoch));
+	for (; file_epoch != AVL_EMPTY_NODE; file_epoch = idx->successor(file_epoch))
+		file_epochs.push_back(file_epoch);
+
+	shift_chunks(conf, symbol, file_epochs, shift);
+}
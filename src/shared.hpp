@@ -5,22 +5,106 @@
 #include "include/config.hpp"
 #include "header.hpp"
 #include "indexer.hpp"
+#include "chunk_reader.hpp"
+#include "chunk_cache.hpp"
+#include "chunk_writer.hpp"
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <vector>
 #include <stdint.h>
 #include <type_traits>
 #include <utility>
 
-static const std::string OLD = "_OLD.dat";
 namespace fs = std::filesystem;
 
+// Book snapshots collected while a chunk's orders are replayed forward from its base state
+struct CheckpointTable
+{
+    std::vector<Checkpoint> entries;
+    std::vector<OrderEntry> levels; // buy then sell levels of every snapshot, back to back
+    uint64_t start_epoch = 0;
+
+    void clear();
+    void track(Config *conf, OrderBook &book, unsigned long order_count, uint64_t epoch, Header &trades);
+};
+
+// Whole base state of the chunk the others of its keyframe group are stored against
+struct Keyframe
+{
+    uint64_t epoch = NO_BASE_REF;
+    uint64_t stamp = 0;
+    OrderBook base;
+};
+
+// Base state as it is written to a chunk's base file: the book's own levels, or its diff
+struct StoredBase
+{
+    const std::vector<OrderEntry> *buys = nullptr;
+    const std::vector<OrderEntry> *sells = nullptr;
+    std::vector<OrderEntry> buy_diff;
+    std::vector<OrderEntry> sell_diff;
+};
+
+bool checkpoint_due(Config *conf, unsigned long orders_since, uint64_t nanos_since);
 void remove_string_end(int times, std::string &source);
 uint64_t generate_epoch_window(Config *conf, uint64_t epoch);
 std::pair<std::string, uint64_t> generate_filename(Config *conf, uint64_t epoch, std::string symbol);
-void write_header(std::ofstream &fout, Header &header);
-void write_base_book(std::ofstream &fout, OrderBook &book);
+void replay_order(OrderBook &book, Header &trades, DataOrder &stored_order, std::string &symbol);
+
+// Chunks are read from the segment they are packed into, or else from their own files
+std::shared_ptr<ChunkReader> open_chunk(Config *conf, const std::string &symbol, uint64_t file_epoch);
+bool read_chunk_header(Config *conf, const std::string &symbol, uint64_t file_epoch, Header &header);
+bool read_keyframe(Config *conf, const std::string &symbol, uint64_t file_epoch, uint64_t base_stamp, OrderBook &book);
+std::shared_ptr<const DecodedChunk> load_chunk(Config *conf, std::string symbol, uint64_t file_epoch);
+bool read_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, std::vector<DataOrder> &orders);
+void build_checkpoints(Config *conf, Header header, OrderBook book, std::vector<DataOrder> &orders, CheckpointTable &checkpoints);
+void prepare_header(Config *conf, std::string &symbol, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders);
+void write_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders);
+void write_chunk(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, std::vector<DataOrder> &orders);
+// Rewrites only the base file of a chunk in the current format and points its orders file to it,
+// leaving the orders as they are. False if either write failed
+bool write_chunk_base(Config *conf, std::string symbol, uint64_t file_epoch, Header &header, OrderBook &base, CheckpointTable &checkpoints, std::vector<DataOrder> &orders);
+void remove_chunk(Config *conf, std::string symbol, uint64_t file_epoch);
+
+// Start of the keyframe group of Config::keyframe_windows windows the epoch falls in
+uint64_t keyframe_group(Config *conf, std::string &symbol, uint64_t epoch);
+// The first chunk of the window's keyframe group, if it comes before the window and stores its
+// whole base state in the current format. The removed chunk doesn't count as part of the group
+bool find_keyframe(Config *conf, std::string &symbol, uint64_t file_epoch, Keyframe &keyframe, uint64_t removed = NO_BASE_REF);
+// Fills in how a base state is stored: whole without a keyframe, otherwise only the levels that
+// differ from the keyframe's, with a quantity of 0 for the ones it lacks. A diff that isn't
+// smaller is stored whole too. The header records the keyframe and the stored sizes
+void encode_base(Header &header, const OrderBook &base, const Keyframe *keyframe, StoredBase &stored);
+
+// Net effect of orders added to (or, reversed, removed from) a symbol's history, which is still
+// missing from the base states of the chunks after them: a signed quantity per price level,
+// so that any number of orders costs one change per touched level in every later chunk
+struct BaseShift
+{
+    std::map<Price, int64_t> buy_delta;
+    std::map<Price, int64_t> sell_delta;
+    bool is_traded = false;
+    unsigned long last_trade_qty = 0;
+    Price last_trade_price = 0;
+    uint64_t last_trade_epoch = 0;
+
+    inline bool empty() const { return buy_delta.empty() && sell_delta.empty() && !is_traded; }
+    void add(const Order &order);
+    // applies the net change of every level to the base state, and moves the header's last trade forward if needed
+    void apply(Header &header, OrderBook &base) const;
+};
+
+// Rewrites the base files of the chunks with the shift applied, on up to Config::reconfig_threads
+// workers. The orders files only switch to the new base files once all of them were written, one
+// after the other. A failed write or switch switches back the chunks already switched over, which
+// leaves the symbol as it was (and returns false), though readers may see some of them shifted
+// in between
+bool shift_chunks(Config *conf, std::string symbol, const std::vector<uint64_t> &file_epochs, const BaseShift &shift);
+
+// Permeates the shift through every chunk after the epoch's window, rewriting each once
+void reconfig_ahead(Config *conf, uint64_t epoch, std::string symbol, BaseShift &shift);
 
 template <typename T>
 Order reverse_polarity(T &data, std::string symbol)
@@ -38,94 +122,22 @@ Order reverse_polarity(T &data, std::string symbol)
 template <typename... Args>
 using all_same = std::conjunction<std::is_same<Order, Args>...>;
 
-// Takes one or more orders and permeates them through future chunk files - to modify base states
+// Takes one or more orders and permeates them through future chunk files - to modify base states.
+// With the delta log on, the change is only logged and the chunks pick it up lazily
 template <typename... Args, typename = std::enable_if_t<all_same<Order, Args...>::value, void>>
 void reconfig_ahead(Config *conf, uint64_t epoch, std::string symbol, Args... args)
 {
-
-    uint64_t timestamp_from = generate_epoch_window(conf, epoch);
-    EpochIndexer *idx = conf->get_or_create_index(symbol);
-    std::vector<uint64_t> epochs = idx->epoch_list_from(timestamp_from);
-
-    unsigned long last_traded_qty = 0;
-    double last_traded_price = 0;
-    uint64_t last_trade_epoch = 0;
-
-    // under the assumption that only one of the given orders will be trade
-    // as 2 orders with the same polarity will never be sent here
-    bool is_traded = false;
-    for (auto &order : {args...})
-        if (order.category == TRADE)
-        {
-            if (is_traded)
-                return;
-
-            last_traded_qty = order.qty;
-            last_traded_price = order.price;
-            last_trade_epoch = order.epoch;
-            is_traded = true;
-        }
-
-    uint32_t i = 0;
-    while (i < epochs.size())
+    if (conf->delta_compact_records)
     {
-        std::string old_name = generate_filename(conf, epochs[i], symbol).first;
-        std::string cached_name = old_name;
-        remove_string_end(4, old_name);
-        old_name.append(OLD);
-        fs::rename(cached_name, old_name);
-
-        std::ifstream fin(old_name, std::ios::in | std::ios::binary);
-        std::ofstream fout(cached_name, std::ios::out | std::ios::binary);
-
-        // need to edit the header
-        Header header;
-        fin.read((char *)&header, sizeof(Header));
-
-        // Transferring base state for buy and sell orders
-        OrderBook book;
-        for (int j = 0; j < header.base_buy; j++)
-        {
-            OrderEntry entry;
-            fin.read((char *)&entry, sizeof(OrderEntry));
-            book.buy_map[entry.price] = entry;
-        }
-
-        for (int j = 0; j < header.base_sell; j++)
-        {
-            OrderEntry entry;
-            fin.read((char *)&entry, sizeof(OrderEntry));
-            book.sell_map[entry.price] = entry;
-        }
-
-        for (auto order : {args...})
-            book.add(order);
-
-        header.base_buy = book.buy_map.size();
-        header.base_sell = book.sell_map.size();
-        if (last_trade_epoch > header.last_trade_epoch)
-        {
-            header.last_trade_epoch = last_trade_epoch;
-            header.last_trade_price = last_traded_price;
-            header.last_trade_qty = last_traded_qty;
-        }
-
-        write_header(fout, header);
-        write_base_book(fout, book);
-
-        // Transfering updates for this file to new copy
-        for (int j = 0; j < header.update_size; j++)
-        {
-            DataOrder stored_order;
-            fin.read((char *)&stored_order, sizeof(DataOrder));
-            fout.write((char *)&stored_order, sizeof(DataOrder));
-        }
-
-        fout.close();
-        fin.close();
-        fs::remove(old_name);
-        i++;
+        conf->deltas.append(symbol, epoch, {args...});
+        return;
     }
+
+    BaseShift shift;
+    for (auto &order : {args...})
+        shift.add(order);
+
+    reconfig_ahead(conf, epoch, symbol, shift);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifndef SpscRing_HPP
+#define SpscRing_HPP
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Occupancy of a ring, sampled on every push
+struct RingStats
+{
+    size_t capacity = 0;
+    size_t peak = 0;
+    double mean = 0;
+    double push_wait = 0; // seconds the producer spent on a full ring
+    double pop_wait = 0;  // seconds the consumer spent on an empty ring
+};
+
+// Bounded lock-free ring between exactly one producer thread and one consumer thread.
+// Blocking calls spin with a yield rather than sleeping, as stages hand over large batches
+template <typename T>
+class SpscRing
+{
+    std::vector<T> slots;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, only moved by the consumer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, only moved by the producer
+    alignas(64) std::atomic<bool> is_closed{false};
+
+    // producer side counters
+    size_t peak = 0;
+    uint64_t pushes = 0;
+    uint64_t occupancy_total = 0;
+    uint64_t push_wait_nanos = 0;
+
+    // consumer side counters
+    alignas(64) uint64_t pop_wait_nanos = 0;
+
+    static inline uint64_t now_nanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+public:
+    // the capacity is rounded up to a power of two
+    SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool try_push(T &item)
+    {
+        size_t curr_tail = tail.load(std::memory_order_relaxed);
+        size_t used = curr_tail - head.load(std::memory_order_acquire);
+        if (used == slots.size())
+            return false;
+
+        slots[curr_tail & mask] = std::move(item);
+        tail.store(curr_tail + 1, std::memory_order_release);
+
+        pushes++;
+        occupancy_total += used + 1;
+        if (used + 1 > peak)
+            peak = used + 1;
+
+        return true;
+    }
+
+    bool try_pop(T &item)
+    {
+        size_t curr_head = head.load(std::memory_order_relaxed);
+        if (curr_head == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[curr_head & mask]);
+        head.store(curr_head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void push(T &&item)
+    {
+        if (try_push(item))
+            return;
+
+        uint64_t wait_start = now_nanos();
+        while (!try_push(item))
+            std::this_thread::yield();
+
+        push_wait_nanos += now_nanos() - wait_start;
+    }
+
+    // false once the ring is closed and drained
+    bool pop(T &item)
+    {
+        if (try_pop(item))
+            return true;
+
+        uint64_t wait_start = now_nanos();
+        bool is_popped = false;
+        while (!(is_popped = try_pop(item)))
+        {
+            // anything pushed before closing is still visible after reading the flag
+            if (is_closed.load(std::memory_order_acquire))
+            {
+                is_popped = try_pop(item);
+                break;
+            }
+
+            std::this_thread::yield();
+        }
+
+        pop_wait_nanos += now_nanos() - wait_start;
+        return is_popped;
+    }
+
+    // true once the ring is closed and everything pushed was popped, for consumers polling with try_pop
+    bool drained() const
+    {
+        return is_closed.load(std::memory_order_acquire) &&
+               head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    // called by the producer once it has pushed everything
+    void close()
+    {
+        is_closed.store(true, std::memory_order_release);
+    }
+
+    // only consistent once both sides are done
+    RingStats stats() const
+    {
+        RingStats ring_stats;
+        ring_stats.capacity = slots.size();
+        ring_stats.peak = peak;
+        ring_stats.mean = pushes ? (double)occupancy_total / pushes : 0;
+        ring_stats.push_wait = push_wait_nanos / 1e9;
+        ring_stats.pop_wait = pop_wait_nanos / 1e9;
+        return ring_stats;
+    }
+};
+
+#endif
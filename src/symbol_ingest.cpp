@@ -0,0 +1,300 @@
+#include "symbol_ingest.hpp"
+#include "include/p_query.hpp"
+#include <algorithm>
+#include <iterator>
+
+SymbolIngest::SymbolIngest(Config *conf, std::string symbol, const OrderBook &book, const Header &trades)
+    : conf(conf), symbol(symbol), book(book), trades(trades)
+{
+    idx = conf->get_or_create_index(symbol);
+    tick_size = idx->tick_size;
+}
+
+void SymbolIngest::add(const DataOrder &order)
+{
+    uint64_t window_start = generate_epoch_window(conf, order.epoch);
+    if (!is_open || window_start != chunk.epoch)
+    {
+        flush();
+
+        // base state and last trade as of the start of the window
+        chunk.header = trades;
+        chunk.base = book;
+        chunk.epoch = window_start;
+        is_open = true;
+    }
+
+    chunk.orders.push_back(order);
+    replay_order(book, trades, chunk.orders.back(), symbol);
+    chunk.checkpoints.track(conf, book, chunk.orders.size(), order.epoch, trades);
+}
+
+void SymbolIngest::reopen(uint64_t window, const Header &header, const std::vector<DataOrder> &orders)
+{
+    chunk.header = header;
+    chunk.base = book;
+    chunk.epoch = window;
+    is_open = true;
+    is_stored = true;
+
+    for (const DataOrder &order : orders)
+    {
+        chunk.orders.push_back(order);
+        replay_order(book, trades, chunk.orders.back(), symbol);
+        chunk.checkpoints.track(conf, book, chunk.orders.size(), order.epoch, trades);
+    }
+}
+
+void SymbolIngest::finish()
+{
+    flush();
+}
+
+void SymbolIngest::flush()
+{
+    if (!is_open)
+        return;
+
+    // a reopened chunk is rewritten right away, since its base file has to move to the next stamp
+    if (is_stored)
+        write_chunk(conf, symbol, chunk.epoch, chunk.header, chunk.base, chunk.checkpoints, chunk.orders);
+    else if (on_chunk)
+        on_chunk(chunk);
+    else
+        write_pending_chunk(conf, symbol, chunk);
+
+    chunk = PendingChunk();
+    is_open = false;
+    is_stored = false;
+}
+
+void write_pending_chunk(Config *conf, const std::string &symbol, PendingChunk &chunk)
+{
+    write_chunk(conf, symbol, chunk.epoch, chunk.header, chunk.base, chunk.checkpoints, chunk.orders);
+    conf->get_or_create_index(symbol)->add(chunk.epoch);
+}
+
+SymbolBackfill::SymbolBackfill(Config *conf, std::string symbol) : conf(conf), symbol(symbol)
+{
+    idx = conf->get_or_create_index(symbol);
+}
+
+void SymbolBackfill::add(const DataOrder &order)
+{
+    open_window(order.epoch);
+    added.push_back(order);
+}
+
+void SymbolBackfill::edit(const ChunkEdit &edit)
+{
+    open_window(edit.stored.epoch);
+    edits.push_back(edit);
+}
+
+void SymbolBackfill::finish()
+{
+    if (!added.empty() || !edits.empty())
+        write_window();
+
+    shift_stored(AVL_EMPTY_NODE);
+}
+
+// Writes out the window of changes held so far once a change for another window arrives
+void SymbolBackfill::open_window(uint64_t epoch)
+{
+    uint64_t change_window = generate_epoch_window(conf, epoch);
+    if (!is_started)
+    {
+        file_epoch = idx->ceiling(change_window);
+        is_started = true;
+    }
+    else if (change_window != window_start)
+    {
+        write_window();
+    }
+
+    window_start = change_window;
+}
+
+bool SymbolBackfill::is_written(uint64_t window)
+{
+    return is_resuming && window <= written_until;
+}
+
+static Order to_order(const DataOrder &order, const std::string &symbol)
+{
+    return Order(symbol, order.epoch, order.id, order.side, order.category, order.qty, order.price);
+}
+
+// Moves the base state of every stored chunk before the window forward by the shift so far.
+// Only their base files are rewritten, on the workers of shift_chunks
+void SymbolBackfill::shift_stored(uint64_t before)
+{
+    if (shift.empty())
+    {
+        file_epoch = before == AVL_EMPTY_NODE ? AVL_EMPTY_NODE : idx->ceiling(before);
+        return;
+    }
+
+    std::vector<uint64_t> file_epochs;
+    for (; file_epoch < before; file_epoch = idx->successor(file_epoch))
+        if (!is_written(file_epoch))
+            file_epochs.push_back(file_epoch);
+
+    if (!shift_chunks(conf, symbol, file_epochs, shift) || !on_written)
+        return;
+
+    for (uint64_t shifted : file_epochs)
+        on_written(shifted);
+}
+
+void SymbolBackfill::write_window()
+{
+    shift_stored(window_start);
+
+    bool is_stored = file_epoch == window_start;
+    if (is_stored)
+        file_epoch = idx->successor(window_start);
+
+    Header header(0, 0, 0, 0, 0, 0);
+    OrderBook base;
+    std::vector<DataOrder> stored;
+
+    if (is_written(window_start))
+    {
+        // only the effect on later chunks is still missing
+        for (ChunkEdit &edit : edits)
+        {
+            shift.add(reverse_polarity(edit.stored, symbol));
+            if (!edit.is_delete)
+                shift.add(to_order(edit.updated, symbol));
+        }
+
+        edited += edits.size();
+    }
+    else if (is_stored)
+    {
+        read_chunk(conf, symbol, window_start, header, base, stored);
+        shift.apply(header, base);
+
+        for (ChunkEdit &edit : edits)
+        {
+            auto found = std::find_if(std::lower_bound(stored.begin(), stored.end(), edit.stored.epoch,
+                                                       [](const DataOrder &order, uint64_t epoch)
+                                                       { return order.epoch < epoch; }),
+                                      stored.end(), [&](const DataOrder &order)
+                                      { return order.id == edit.stored.id && order.epoch == edit.stored.epoch; });
+            if (found == stored.end())
+                continue;
+
+            edited++;
+            shift.add(reverse_polarity(*found, symbol));
+            if (edit.is_delete)
+            {
+                stored.erase(found);
+                continue;
+            }
+
+            *found = edit.updated;
+            shift.add(to_order(edit.updated, symbol));
+        }
+    }
+    else if (idx->exists_lower(window_start))
+    {
+        // earlier chunks already carry the backfill, but the state of a gap is taken from the base
+        // of the next stored chunk, which doesn't yet
+        PQuery processor(conf);
+        QueryResult query = processor.query_stored(added.front().epoch, symbol);
+        base = query.book;
+        header.last_trade_qty = query.last_trade_qty;
+        header.last_trade_price = query.last_trade_price;
+        header.last_trade_epoch = query.last_trade_epoch;
+        if (file_epoch != AVL_EMPTY_NODE)
+            shift.apply(header, base);
+    }
+    else
+    {
+        // there is nothing to trade or cancel yet
+        auto first_new = std::find_if(added.begin(), added.end(), [](const DataOrder &order)
+                                      { return order.category == NEW; });
+        added.erase(added.begin(), first_new);
+    }
+
+    if (!is_written(window_start))
+    {
+        // new orders go after the stored orders of the same epoch, like single inserts
+        std::vector<DataOrder> merged;
+        merged.reserve(stored.size() + added.size());
+        std::merge(stored.begin(), stored.end(), added.begin(), added.end(), std::back_inserter(merged),
+                   [](const DataOrder &a, const DataOrder &b)
+                   { return a.epoch < b.epoch; });
+
+        // a chunk left without orders is dropped, like after deleting its last order
+        if (!merged.empty())
+            write_chunk(conf, symbol, window_start, header, base, merged);
+        else if (is_stored)
+            remove_chunk(conf, symbol, window_start);
+
+        if (merged.empty() && is_stored)
+            idx->remove(window_start);
+        else if (!merged.empty() && !is_stored)
+            idx->add(window_start);
+
+        if (on_written && (is_stored || !merged.empty()))
+            on_written(window_start);
+    }
+
+    inserted += added.size();
+    for (DataOrder &order : added)
+        shift.add(to_order(order, symbol));
+
+    added.clear();
+    edits.clear();
+}
+
+// Ingestion state carrying on the last stored chunk, or nullptr if some of its orders come after
+// the first one to ingest
+static std::unique_ptr<SymbolIngest> reopen_symbol_ingest(Config *conf, std::string &symbol, uint64_t window, uint64_t first_epoch)
+{
+    Header header(0, 0, 0, 0, 0, 0);
+    OrderBook base;
+    std::vector<DataOrder> orders;
+    if (!read_chunk(conf, symbol, window, header, base, orders) || (!orders.empty() && orders.back().epoch > first_epoch))
+        return nullptr;
+
+    // last trade as of the start of the window, which the replay of its orders moves on from
+    Header trades(0, 0, 0, 0, 0, 0);
+    trades.last_trade_qty = header.last_trade_qty;
+    trades.last_trade_price = header.last_trade_price;
+    trades.last_trade_epoch = header.last_trade_epoch;
+
+    std::unique_ptr<SymbolIngest> ingest = std::make_unique<SymbolIngest>(conf, symbol, base, trades);
+    ingest->reopen(window, header, orders);
+    return ingest;
+}
+
+std::unique_ptr<SymbolIngest> start_symbol_ingest(Config *conf, std::string symbol, uint64_t first_epoch)
+{
+    EpochIndexer *idx = conf->get_or_create_index(symbol);
+    Header trades(0, 0, 0, 0, 0, 0);
+
+    if (idx->empty())
+        return std::make_unique<SymbolIngest>(conf, symbol, OrderBook(), trades);
+
+    // chunks at or after the first window would be overwritten by a forward pass, unless the
+    // first window's chunk is the last one and its orders all come first
+    uint64_t first_window = generate_epoch_window(conf, first_epoch);
+    uint64_t stored = idx->ceiling(first_window);
+    if (stored == first_window && idx->successor(stored) == AVL_EMPTY_NODE)
+        return reopen_symbol_ingest(conf, symbol, stored, first_epoch);
+    if (stored != AVL_EMPTY_NODE)
+        return nullptr;
+
+    PQuery processor(conf);
+    QueryResult query = processor.query_stored(first_epoch, symbol);
+    trades.last_trade_qty = query.last_trade_qty;
+    trades.last_trade_price = query.last_trade_price;
+    trades.last_trade_epoch = query.last_trade_epoch;
+
+    return std::make_unique<SymbolIngest>(conf, symbol, query.book, trades);
+}
@@ -0,0 +1,125 @@
+#ifndef SymbolIngest_HPP
+#define SymbolIngest_HPP
+
+#include "include/config.hpp"
+#include "include/order.hpp"
+#include "include/order_book.hpp"
+#include "header.hpp"
+#include "indexer.hpp"
+#include "shared.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A chunk whose window is complete, ready to be written
+struct PendingChunk
+{
+    uint64_t epoch = 0;
+    Header header{0, 0, 0, 0, 0, 0};
+    OrderBook base;
+    CheckpointTable checkpoints;
+    std::vector<DataOrder> orders;
+};
+
+// Writes the chunk and adds its window to the symbol's index
+void write_pending_chunk(Config *conf, const std::string &symbol, PendingChunk &chunk);
+
+// Single forward pass over the sorted orders of one symbol: every chunk is kept in memory until
+// its window is complete, so that its checkpoints are taken from the same book the orders are
+// applied to. Only used where no chunk exists at or after the first order's window,
+// SymbolBackfill takes over otherwise
+class SymbolIngest
+{
+    Config *conf;
+    std::string symbol;
+    EpochIndexer *idx;
+
+    OrderBook book;
+    Header trades; // running last trade, as of the latest ingested order
+
+    PendingChunk chunk;
+    bool is_open = false;
+    bool is_stored = false; // the open chunk was reopened, and is written in place of the stored one
+
+    void flush();
+
+public:
+    double tick_size;
+
+    // Receives every completed chunk, which is written right away if not set
+    std::function<void(PendingChunk &)> on_chunk;
+
+    // book and last trade as of right before the first order to ingest
+    SymbolIngest(Config *conf, std::string symbol, const OrderBook &book, const Header &trades);
+
+    // Carries on the stored chunk of the window, whose orders all come at or before the first one
+    // to ingest. The book has to be its base state
+    void reopen(uint64_t window, const Header &header, const std::vector<DataOrder> &orders);
+
+    // orders have to arrive in epoch order, with their price already in ticks
+    void add(const DataOrder &order);
+    void finish();
+};
+
+// Change to a stored order: either removed, or replaced by an order of the same epoch and id.
+// Only the epoch and id of the stored order are needed, unless its chunk was already rewritten
+// by an interrupted pass that is being resumed
+struct ChunkEdit
+{
+    DataOrder stored;
+    DataOrder updated;
+    bool is_delete;
+};
+
+// Sort-merge of sorted orders (and edits of stored ones) into a symbol's stored history, for
+// orders landing before or within stored chunks. Windows are visited in order from the first one
+// with a change: each chunk is rewritten exactly once, with its changes merged in and the combined
+// effect of every earlier change on its base state. Only one window of changes is held at a time.
+// Like single inserts, an order that would open a symbol's history has to be NEW
+class SymbolBackfill
+{
+    Config *conf;
+    std::string symbol;
+    EpochIndexer *idx;
+
+    BaseShift shift;
+    uint64_t file_epoch = AVL_EMPTY_NODE; // first stored chunk not visited yet
+    uint64_t window_start = 0;
+    std::vector<DataOrder> added;
+    std::vector<ChunkEdit> edits;
+    bool is_started = false;
+
+    void open_window(uint64_t epoch);
+    void shift_stored(uint64_t before);
+    void write_window();
+    bool is_written(uint64_t window);
+
+public:
+    size_t inserted = 0;
+    size_t edited = 0; // edits whose stored order was found
+
+    // When resuming an interrupted pass, chunks up to this window already carry the changes,
+    // which then only move the base states of the chunks after it
+    bool is_resuming = false;
+    uint64_t written_until = 0;
+
+    // Called after every chunk rewrite with its window, in ascending order
+    std::function<void(uint64_t)> on_written;
+
+    SymbolBackfill(Config *conf, std::string symbol);
+
+    // orders and edits have to arrive in epoch order, with their prices already in ticks
+    void add(const DataOrder &order);
+    void edit(const ChunkEdit &edit);
+    void finish();
+};
+
+// Ingestion state for a symbol whose first order to ingest is at the epoch, or nullptr if the
+// orders have to be backfilled since they would land before or within stored chunks. Orders
+// carrying on after every stored order reopen the last chunk instead.
+// The symbol's lock has to be held by the caller
+std::unique_ptr<SymbolIngest> start_symbol_ingest(Config *conf, std::string symbol, uint64_t first_epoch);
+
+#endif
@@ -0,0 +1,151 @@
+#include "uring.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef OW_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Times a submission is retried after being interrupted or refused for lack of resources
+static const int SUBMIT_ATTEMPTS = 8;
+
+static inline bool is_transient(int error)
+{
+    return error == EINTR || error == EAGAIN || error == EBUSY;
+}
+
+Uring::Uring(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqe_array_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqe_array = mmap(nullptr, sqe_array_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_array == MAP_FAILED)
+    {
+        if (sq_ring != MAP_FAILED)
+            munmap(sq_ring, sq_ring_size);
+        if (cq_ring != MAP_FAILED)
+            munmap(cq_ring, cq_ring_size);
+        if (sqe_array != MAP_FAILED)
+            munmap(sqe_array, sqe_array_size);
+
+        sq_ring = cq_ring = sqe_array = nullptr;
+        ::close(fd);
+        return;
+    }
+
+    char *sq = (char *)sq_ring;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_indexes = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)cq_ring;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    ring_fd = fd;
+}
+
+Uring::~Uring()
+{
+    if (!valid())
+        return;
+
+    munmap(sq_ring, sq_ring_size);
+    munmap(cq_ring, cq_ring_size);
+    munmap(sqe_array, sqe_array_size);
+    ::close(ring_fd);
+}
+
+bool Uring::write(int fd, const void *data, unsigned length, uint64_t offset, uint64_t tag)
+{
+    unsigned tail = *sq_tail;
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head > *sq_mask)
+        return false;
+
+    unsigned idx = tail & *sq_mask;
+    io_uring_sqe *sqe = (io_uring_sqe *)sqe_array + idx;
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)data;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = tag;
+
+    sq_indexes[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    for (int attempt = 0; attempt < SUBMIT_ATTEMPTS; attempt++)
+    {
+        int submitted = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+        if (submitted > 0)
+            return true;
+        if (submitted < 0 && !is_transient(errno))
+            break;
+    }
+
+    // the kernel only consumes entries within io_uring_enter, so one it never took can be taken
+    // back, leaving nothing behind that a later submission would hand over
+    if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) != tail)
+        return true;
+
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+}
+
+bool Uring::wait(uint64_t &tag, int &result)
+{
+    while (true)
+    {
+        unsigned head = *cq_head;
+        if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe *cqe = (io_uring_cqe *)cqes + (head & *cq_mask);
+            tag = cqe->user_data;
+            result = cqe->res;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // completions still land in the ring while waiting on it fails, so it is polled instead
+        if (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && !is_transient(errno))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+#else
+
+Uring::Uring(unsigned entries) {}
+Uring::~Uring() {}
+
+bool Uring::write(int fd, const void *data, unsigned length, uint64_t offset, uint64_t tag)
+{
+    return false;
+}
+
+bool Uring::wait(uint64_t &tag, int &result)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef Uring_HPP
+#define Uring_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define OW_HAS_IO_URING 1
+#endif
+
+// Minimal io_uring submission/completion ring for positioned writes, set up straight through
+// the system calls so that no extra library is needed. valid() is false wherever io_uring is
+// unavailable (other platforms, old kernels or sandboxes blocking it), and callers fall back to pwrite
+class Uring
+{
+    int ring_fd = -1;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    void *sqe_array = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    size_t sqe_array_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_indexes = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    void *cqes = nullptr;
+
+public:
+    Uring(unsigned entries);
+    ~Uring();
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    inline bool valid() const { return ring_fd >= 0; }
+
+    // Queues and submits a write, retrying interrupted submissions. False if the ring is full or
+    // the kernel never took the write, which is then withdrawn from the ring again
+    bool write(int fd, const void *data, unsigned length, uint64_t offset, uint64_t tag);
+
+    // Blocks until a write completes, giving back its tag and result (bytes written or -errno).
+    // Interrupted waits are resumed, and the ring is polled if waiting fails, as submitted writes
+    // may still use their buffers. Only false without io_uring
+    bool wait(uint64_t &tag, int &result);
+};
+
+#endif
@@ -0,0 +1,380 @@
+#include "write_buffer.hpp"
+#include "include/config.hpp"
+#include "shared.hpp"
+#include "symbol_ingest.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+uint64_t MemSnapshot::first_epoch() const
+{
+    if (inserts.empty())
+        return edits.begin()->first.first;
+    if (edits.empty())
+        return inserts.front().epoch;
+
+    return std::min(inserts.front().epoch, edits.begin()->first.first);
+}
+
+bool MemSnapshot::edit_stored(DataOrder &order) const
+{
+    auto edit = edits.find({order.epoch, order.id});
+    if (edit == edits.end())
+        return true;
+
+    if (edit->second.is_delete)
+        return false;
+
+    order = edit->second.updated;
+    return true;
+}
+
+MemTable::MemTable(Config *conf, const std::string &symbol) : symbol(symbol)
+{
+    wal_file = conf->data_dir + symbol + "/" + WAL;
+    progress_file = conf->data_dir + symbol + "/" + FLUSH_PROGRESS;
+}
+
+MemTable::~MemTable()
+{
+    if (wal_fd >= 0)
+        ::close(wal_fd);
+}
+
+void MemTable::load(Config *conf)
+{
+    if (is_loaded)
+        return;
+
+    is_loaded = true;
+    wal_fd = ::open(wal_file.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+    if (wal_fd < 0)
+        return;
+
+    WalRecord record;
+    off_t length = 0;
+    while (pread(wal_fd, &record, sizeof(WalRecord), length) == sizeof(WalRecord))
+    {
+        apply(record);
+        length += sizeof(WalRecord);
+    }
+
+    // a record cut off by a crash was never acknowledged
+    if (ftruncate(wal_fd, length) != 0)
+        return;
+
+    int progress_fd = ::open(progress_file.c_str(), O_RDONLY);
+    if (progress_fd < 0)
+        return;
+
+    is_resuming = pread(progress_fd, &written_until, sizeof(uint64_t), 0) == sizeof(uint64_t);
+    ::close(progress_fd);
+
+    // the flush was only interrupted after emptying the log
+    if (pending.empty())
+    {
+        ::unlink(progress_file.c_str());
+        is_resuming = false;
+        return;
+    }
+
+    // chunks written before the interruption already carry the log, which would be counted twice
+    flush(conf);
+}
+
+std::vector<DataOrder>::iterator MemTable::find_insert(uint64_t epoch, uint64_t id)
+{
+    auto found = std::lower_bound(pending.inserts.begin(), pending.inserts.end(), epoch,
+                                  [](const DataOrder &order, uint64_t epoch)
+                                  { return order.epoch < epoch; });
+    for (; found != pending.inserts.end() && found->epoch == epoch; found++)
+        if (found->id == id)
+            return found;
+
+    return pending.inserts.end();
+}
+
+void MemTable::apply(const WalRecord &record)
+{
+    MemSnapshot::order_key key = {record.stored.epoch, record.stored.id};
+    auto insert = record.op == WAL_INSERT ? pending.inserts.end() : find_insert(key.first, key.second);
+
+    if (record.op == WAL_INSERT)
+    {
+        // after the buffered orders of the same epoch, like single inserts
+        auto position = std::upper_bound(pending.inserts.begin(), pending.inserts.end(), record.order.epoch,
+                                         [](uint64_t epoch, const DataOrder &order)
+                                         { return epoch < order.epoch; });
+        pending.inserts.insert(position, record.order);
+    }
+    else if (insert != pending.inserts.end())
+    {
+        // the order never reached a chunk, so it is changed in place
+        if (record.op == WAL_DELETE)
+            pending.inserts.erase(insert);
+        else
+            *insert = record.order;
+    }
+    else
+    {
+        auto edit = pending.edits.find(key);
+        if (edit == pending.edits.end())
+            edit = pending.edits.emplace(key, MemEdit{record.stored, record.stored, false}).first;
+
+        edit->second.is_delete = record.op == WAL_DELETE;
+        if (record.op == WAL_UPDATE)
+            edit->second.updated = record.order;
+    }
+
+    size = pending.size();
+}
+
+bool MemTable::append(const WalRecord &record)
+{
+    if (wal_fd < 0 || write(wal_fd, &record, sizeof(WalRecord)) != sizeof(WalRecord))
+        return false;
+
+    apply(record);
+    return true;
+}
+
+bool MemTable::insert(Config *conf, Order &order)
+{
+    // like single inserts, there is nothing to trade or cancel before the first order
+    if (order.category != NEW && conf->get_or_create_index(symbol)->empty() && pending.inserts.empty())
+        return false;
+
+    WalRecord record;
+    record.op = WAL_INSERT;
+    record.order = DataOrder(order);
+    record.stored = record.order;
+    return append(record);
+}
+
+// The order as it currently is, whether buffered or stored in its chunk.
+// False if there is no such order, or its deletion is buffered
+static bool find_current(Config *conf,
+                         const std::string &symbol,
+                         MemSnapshot &pending,
+                         std::vector<DataOrder>::iterator insert,
+                         uint64_t id,
+                         uint64_t epoch,
+                         DataOrder &current)
+{
+    if (insert != pending.inserts.end())
+    {
+        current = *insert;
+        return true;
+    }
+
+    auto edit = pending.edits.find({epoch, id});
+    if (edit != pending.edits.end())
+    {
+        current = edit->second.stored;
+        return !edit->second.is_delete;
+    }
+
+    uint64_t window_start = generate_epoch_window(conf, epoch);
+    if (!conf->get_or_create_index(symbol)->find(window_start))
+        return false;
+
+    std::shared_ptr<const DecodedChunk> chunk = load_chunk(conf, symbol, window_start);
+    if (!chunk)
+        return false;
+
+    auto found = std::find_if(chunk->orders.begin(), chunk->orders.end(), [&](const DataOrder &stored_order)
+                              { return stored_order.id == id && stored_order.epoch == epoch; });
+    if (found == chunk->orders.end())
+        return false;
+
+    current = *found;
+    return true;
+}
+
+bool MemTable::update(Config *conf, Order &order)
+{
+    WalRecord record;
+    record.op = WAL_UPDATE;
+    record.order = DataOrder(order);
+
+    if (!find_current(conf, symbol, pending, find_insert(order.epoch, order.id), order.id, order.epoch, record.stored))
+        return false;
+
+    return append(record);
+}
+
+bool MemTable::remove(Config *conf, uint64_t id, uint64_t epoch)
+{
+    WalRecord record;
+    record.op = WAL_DELETE;
+
+    if (!find_current(conf, symbol, pending, find_insert(epoch, id), id, epoch, record.stored))
+        return false;
+
+    record.order = record.stored;
+    return append(record);
+}
+
+void MemTable::flush(Config *conf)
+{
+    if (pending.empty())
+        return;
+
+    SymbolBackfill backfill(conf, symbol);
+    backfill.is_resuming = is_resuming;
+    backfill.written_until = written_until;
+
+    // the last rewritten window is recorded, so an interrupted flush can be finished on the next load
+    int progress_fd = ::open(progress_file.c_str(), O_WRONLY | O_CREAT, 0666);
+    backfill.on_written = [&](uint64_t window)
+    {
+        if (progress_fd >= 0)
+            pwrite(progress_fd, &window, sizeof(uint64_t), 0);
+    };
+
+    // changes are handed over in epoch order, inserts first within an epoch
+    auto edit = pending.edits.begin();
+    for (DataOrder &order : pending.inserts)
+    {
+        for (; edit != pending.edits.end() && edit->first.first < order.epoch; edit++)
+            backfill.edit(ChunkEdit{edit->second.stored, edit->second.updated, edit->second.is_delete});
+
+        backfill.add(order);
+    }
+
+    for (; edit != pending.edits.end(); edit++)
+        backfill.edit(ChunkEdit{edit->second.stored, edit->second.updated, edit->second.is_delete});
+
+    backfill.finish();
+    flushes++;
+
+    if (progress_fd >= 0)
+        ::close(progress_fd);
+
+    // the index is only written on shutdown otherwise, and has to know the new chunks before
+    // the log is gone
+    conf->get_or_create_index(symbol)->flush();
+
+    if (wal_fd >= 0 && ftruncate(wal_fd, 0) != 0)
+        return;
+
+    ::unlink(progress_file.c_str());
+    pending = MemSnapshot();
+    size = 0;
+    is_resuming = false;
+}
+
+WriteBuffer::WriteBuffer(Config *conf) : conf(conf) {}
+
+WriteBuffer::~WriteBuffer()
+{
+    {
+        std::lock_guard<std::mutex> guard(buffer_mutex);
+        is_stopping = true;
+    }
+
+    wake.notify_one();
+    if (flusher.joinable())
+        flusher.join();
+
+    flush_all();
+}
+
+MemTable &WriteBuffer::table(const std::string &symbol)
+{
+    MemTable *found;
+    {
+        std::lock_guard<std::mutex> guard(buffer_mutex);
+        std::unique_ptr<MemTable> &entry = tables[symbol];
+        if (!entry)
+        {
+            conf->get_or_create_index(symbol);
+            entry = std::make_unique<MemTable>(conf, symbol);
+        }
+
+        // the last flush on destruction runs without the flusher
+        found = entry.get();
+        if (!flusher.joinable() && !is_stopping)
+            flusher = std::thread(&WriteBuffer::run_flusher, this);
+    }
+
+    found->load(conf);
+    return *found;
+}
+
+bool WriteBuffer::has_pending(const std::string &symbol)
+{
+    {
+        std::lock_guard<std::mutex> guard(buffer_mutex);
+        auto found = tables.find(symbol);
+        if (found != tables.end())
+            return found->second->size > 0;
+    }
+
+    // a log left by an earlier run is only replayed once the memtable is opened
+    std::error_code error;
+    return std::filesystem::file_size(conf->data_dir + symbol + "/" + WAL, error) > 0 && !error;
+}
+
+void WriteBuffer::written(MemTable &table)
+{
+    if (table.size >= conf->memtable_orders)
+        wake.notify_one();
+}
+
+void WriteBuffer::flush(const std::string &symbol)
+{
+    table(symbol).flush(conf);
+}
+
+void WriteBuffer::flush_all()
+{
+    std::vector<std::string> symbols;
+    {
+        std::lock_guard<std::mutex> guard(buffer_mutex);
+        for (auto &entry : tables)
+            if (entry.second->size > 0)
+                symbols.push_back(entry.first);
+    }
+
+    for (std::string &symbol : symbols)
+    {
+        std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+        flush(symbol);
+    }
+}
+
+// Flushes every memtable on each interval, and in between the ones that are due
+void WriteBuffer::run_flusher()
+{
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(buffer_mutex);
+
+    while (!is_stopping)
+    {
+        std::chrono::milliseconds interval(conf->flush_interval_ms);
+        wake.wait_for(guard, interval);
+        if (is_stopping)
+            break;
+
+        bool is_interval = std::chrono::steady_clock::now() - last_flush >= interval;
+        std::vector<std::string> symbols;
+        for (auto &entry : tables)
+            if (entry.second->size > 0 && (is_interval || entry.second->size >= conf->memtable_orders))
+                symbols.push_back(entry.first);
+
+        if (is_interval)
+            last_flush = std::chrono::steady_clock::now();
+
+        // symbol locks are taken without the buffer mutex, which writers take under theirs
+        guard.unlock();
+        for (std::string &symbol : symbols)
+        {
+            std::lock_guard<std::mutex> lock(conf->lock_for(symbol));
+            flush(symbol);
+        }
+        guard.lock();
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef WriteBuffer_HPP
+#define WriteBuffer_HPP
+
+#include "include/order.hpp"
+#include "include/order_book.hpp"
+#include "header.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+struct Config;
+
+static const std::string WAL = "WAL.dat";
+static const std::string FLUSH_PROGRESS = "FLUSH.dat";
+
+// Default interval of the background flush of buffered orders
+static const unsigned int FLUSH_INTERVAL_MS = 1000;
+
+enum WalOp : uint32_t
+{
+    WAL_INSERT,
+    WAL_UPDATE,
+    WAL_DELETE,
+};
+
+// Record of the write-ahead log. Updates and deletes carry the order they replace or remove,
+// so the log can be replayed without reading any chunk
+struct WalRecord
+{
+    WalOp op;
+    DataOrder order;
+    DataOrder stored;
+};
+
+// Buffered change to an order stored in a chunk, keyed by its epoch and id
+struct MemEdit
+{
+    DataOrder stored;
+    DataOrder updated;
+    bool is_delete;
+};
+
+// Orders of one symbol that are not merged into its chunks yet
+struct MemSnapshot
+{
+    typedef std::pair<uint64_t, uint64_t> order_key; // epoch, id
+
+    std::vector<DataOrder> inserts; // sorted by epoch, in arrival order within an epoch
+    std::map<order_key, MemEdit> edits;
+
+    inline size_t size() const { return inserts.size() + edits.size(); }
+    inline bool empty() const { return inserts.empty() && edits.empty(); }
+
+    // epoch of the earliest buffered change, with at least one buffered
+    uint64_t first_epoch() const;
+    // rewrites a stored order as buffered, false if it was deleted
+    bool edit_stored(DataOrder &order) const;
+};
+
+// Memtable of one symbol and its write-ahead log. Everything but size is only touched with the
+// symbol's lock held
+class MemTable
+{
+    std::string symbol;
+    std::string wal_file;
+    std::string progress_file;
+    int wal_fd = -1;
+    bool is_loaded = false;
+    bool is_resuming = false;
+    uint64_t written_until = 0;
+
+    void apply(const WalRecord &record);
+    bool append(const WalRecord &record);
+    std::vector<DataOrder>::iterator find_insert(uint64_t epoch, uint64_t id);
+
+public:
+    MemSnapshot pending;
+    std::atomic<size_t> size{0};
+    uint64_t flushes = 0; // completed merges into the chunks, for cursors holding a copy of pending
+
+    MemTable(Config *conf, const std::string &symbol);
+    ~MemTable();
+
+    MemTable(const MemTable &) = delete;
+    MemTable &operator=(const MemTable &) = delete;
+
+    // replays the log left by an earlier run, finishing a flush it was interrupted in
+    void load(Config *conf);
+
+    bool insert(Config *conf, Order &order);
+    bool update(Config *conf, Order &order);
+    bool remove(Config *conf, uint64_t id, uint64_t epoch);
+
+    // merges every buffered change into the chunks in one pass, then empties the log
+    void flush(Config *conf);
+};
+
+// Buffers single-order inserts, updates and deletes in per-symbol memtables backed by
+// write-ahead logs, so a write only costs a log append. A background thread merges a memtable
+// into the chunks once it holds Config::memtable_orders changes, or on every flush interval
+class WriteBuffer
+{
+    Config *conf;
+    std::mutex buffer_mutex;
+    std::unordered_map<std::string, std::unique_ptr<MemTable>> tables;
+
+    std::thread flusher;
+    std::condition_variable wake;
+    bool is_stopping = false;
+
+    void run_flusher();
+
+public:
+    WriteBuffer(Config *conf);
+    ~WriteBuffer();
+
+    WriteBuffer(const WriteBuffer &) = delete;
+    WriteBuffer &operator=(const WriteBuffer &) = delete;
+
+    // memtable of the symbol, loaded from its log, with the symbol's lock held by the caller
+    MemTable &table(const std::string &symbol);
+    // whether changes of the symbol may be buffered, without taking its lock
+    bool has_pending(const std::string &symbol);
+    // wakes the flusher up if the memtable is due
+    void written(MemTable &table);
+    // merges the symbol's buffered changes into its chunks, with its lock held by the caller
+    void flush(const std::string &symbol);
+    void flush_all();
+};
+
+#endif